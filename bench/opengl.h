@@ -0,0 +1,6 @@
+#pragma once
+
+// Stands in for the GL header of an application, so ShaderSet builds against the stub GL of shaderset_bench.cpp
+// The declarations come from the Khronos core profile header, and shaderset_bench.cpp defines the functions.
+#define GL_GLEXT_PROTOTYPES 1
+#include <GL/glcorearb.h>
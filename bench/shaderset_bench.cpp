@@ -0,0 +1,441 @@
+// Measures the CPU cost of ShaderSet itself, against a stub GL that does no work (or waits a configurable latency).
+// Build from the repository root (the bench directory comes first, so its opengl.h replaces the application's):
+//     g++ -std=c++11 -O2 -Ibench bench/shaderset_bench.cpp shaderset.cpp -o shaderset_bench -pthread
+// Run with --help for the options. It writes the synthetic shader files to a shaderset_bench_files directory in the working directory,
+// which it removes before exiting.
+// ShaderSet reports every link on stderr, so redirect it to keep the results readable (eg. ./shaderset_bench --watch 2>/dev/null)
+
+#include "../shaderset.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#include <direct.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static uint64_t NowNanoseconds()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// peak resident memory of the process, in bytes
+static uint64_t PeakMemory()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.PeakWorkingSetSize;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss;
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+//
+// Stub GL
+// Compiles and links complete after a latency (0 by default), which GL_COMPLETION_STATUS_KHR reports, and status queries wait for.
+//
+
+static uint64_t gCompileLatency = 0;
+static uint64_t gLinkLatency = 0;
+
+namespace
+{
+    struct StubShader
+    {
+        uint64_t CompletionTime = 0;
+    };
+
+    struct StubProgram
+    {
+        uint64_t CompletionTime = 0;
+        std::vector<GLuint> Shaders;
+    };
+
+    // the worker threads of ShaderSet call GL too
+    std::mutex gStubMutex;
+    std::unordered_map<GLuint, StubShader> gStubShaders;
+    std::unordered_map<GLuint, StubProgram> gStubPrograms;
+    GLuint gStubNextName = 1;
+}
+
+static void WaitUntil(uint64_t completionTime)
+{
+    uint64_t now = NowNanoseconds();
+    if (completionTime > now)
+    {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(completionTime - now));
+    }
+}
+
+extern "C" {
+
+GLuint glCreateShader(GLenum) { std::lock_guard<std::mutex> lock(gStubMutex); gStubShaders[gStubNextName]; return gStubNextName++; }
+void glDeleteShader(GLuint shader) { std::lock_guard<std::mutex> lock(gStubMutex); gStubShaders.erase(shader); }
+void glShaderSource(GLuint, GLsizei, const GLchar* const*, const GLint*) {}
+void glShaderBinary(GLsizei, const GLuint*, GLenum, const void*, GLsizei) {}
+void glSpecializeShader(GLuint shader, const GLchar*, GLuint, const GLuint*, const GLuint*) { std::lock_guard<std::mutex> lock(gStubMutex); gStubShaders[shader].CompletionTime = NowNanoseconds() + gCompileLatency; }
+void glCompileShader(GLuint shader) { std::lock_guard<std::mutex> lock(gStubMutex); gStubShaders[shader].CompletionTime = NowNanoseconds() + gCompileLatency; }
+
+void glGetShaderiv(GLuint shader, GLenum pname, GLint* params)
+{
+    uint64_t completionTime;
+    {
+        std::lock_guard<std::mutex> lock(gStubMutex);
+        completionTime = gStubShaders[shader].CompletionTime;
+    }
+
+    if (pname == GL_COMPLETION_STATUS_KHR)
+    {
+        *params = NowNanoseconds() >= completionTime;
+        return;
+    }
+    if (pname == GL_COMPILE_STATUS)
+    {
+        WaitUntil(completionTime);
+        *params = GL_TRUE;
+        return;
+    }
+    *params = 0;
+}
+
+void glGetShaderInfoLog(GLuint, GLsizei bufSize, GLsizei* length, GLchar* infoLog) { if (bufSize > 0) infoLog[0] = 0; if (length) *length = 0; }
+
+GLuint glCreateProgram() { std::lock_guard<std::mutex> lock(gStubMutex); gStubPrograms[gStubNextName]; return gStubNextName++; }
+void glDeleteProgram(GLuint program) { std::lock_guard<std::mutex> lock(gStubMutex); gStubPrograms.erase(program); }
+void glAttachShader(GLuint program, GLuint shader) { std::lock_guard<std::mutex> lock(gStubMutex); gStubPrograms[program].Shaders.push_back(shader); }
+
+void glDetachShader(GLuint program, GLuint shader)
+{
+    std::lock_guard<std::mutex> lock(gStubMutex);
+    std::vector<GLuint>& shaders = gStubPrograms[program].Shaders;
+    shaders.erase(std::remove(shaders.begin(), shaders.end(), shader), shaders.end());
+}
+
+void glGetAttachedShaders(GLuint program, GLsizei maxCount, GLsizei* count, GLuint* shaders)
+{
+    std::lock_guard<std::mutex> lock(gStubMutex);
+    const std::vector<GLuint>& attached = gStubPrograms[program].Shaders;
+    GLsizei n = std::min(maxCount, (GLsizei)attached.size());
+    std::copy(attached.begin(), attached.begin() + n, shaders);
+    if (count) *count = n;
+}
+
+void glLinkProgram(GLuint program) { std::lock_guard<std::mutex> lock(gStubMutex); gStubPrograms[program].CompletionTime = NowNanoseconds() + gLinkLatency; }
+void glProgramParameteri(GLuint, GLenum, GLint) {}
+
+void glGetProgramiv(GLuint program, GLenum pname, GLint* params)
+{
+    uint64_t completionTime;
+    GLint numShaders;
+    {
+        std::lock_guard<std::mutex> lock(gStubMutex);
+        completionTime = gStubPrograms[program].CompletionTime;
+        numShaders = (GLint)gStubPrograms[program].Shaders.size();
+    }
+
+    switch (pname)
+    {
+    case GL_COMPLETION_STATUS_KHR: *params = NowNanoseconds() >= completionTime; break;
+    case GL_LINK_STATUS: WaitUntil(completionTime); *params = GL_TRUE; break;
+    case GL_ATTACHED_SHADERS: *params = numShaders; break;
+    case GL_PROGRAM_BINARY_LENGTH: *params = 4; break;
+    default: *params = 0; break;
+    }
+}
+
+void glGetProgramInfoLog(GLuint, GLsizei bufSize, GLsizei* length, GLchar* infoLog) { if (bufSize > 0) infoLog[0] = 0; if (length) *length = 0; }
+void glGetProgramBinary(GLuint, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary) { GLsizei n = std::min(bufSize, 4); memcpy(binary, "STUB", n); *length = n; *binaryFormat = 1; }
+void glProgramBinary(GLuint program, GLenum, const void*, GLsizei) { std::lock_guard<std::mutex> lock(gStubMutex); gStubPrograms[program].CompletionTime = 0; }
+
+void glGenProgramPipelines(GLsizei n, GLuint* pipelines) { std::lock_guard<std::mutex> lock(gStubMutex); for (GLsizei i = 0; i < n; i++) pipelines[i] = gStubNextName++; }
+void glDeleteProgramPipelines(GLsizei, const GLuint*) {}
+void glUseProgramStages(GLuint, GLbitfield, GLuint) {}
+
+void glGetActiveUniform(GLuint, GLuint, GLsizei, GLsizei*, GLint*, GLenum*, GLchar*) {}
+void glGetActiveAttrib(GLuint, GLuint, GLsizei, GLsizei*, GLint*, GLenum*, GLchar*) {}
+void glGetActiveUniformBlockName(GLuint, GLuint, GLsizei, GLsizei*, GLchar*) {}
+void glGetActiveUniformBlockiv(GLuint, GLuint, GLenum, GLint* params) { *params = 0; }
+GLint glGetUniformLocation(GLuint, const GLchar*) { return -1; }
+GLint glGetAttribLocation(GLuint, const GLchar*) { return -1; }
+void glGetProgramInterfaceiv(GLuint, GLenum, GLenum, GLint* params) { *params = 0; }
+void glGetProgramResourceName(GLuint, GLenum, GLuint, GLsizei, GLsizei*, GLchar*) {}
+void glGetProgramResourceiv(GLuint, GLenum, GLuint, GLsizei, const GLenum*, GLsizei, GLsizei*, GLint*) {}
+
+void glGenQueries(GLsizei n, GLuint* ids) { std::lock_guard<std::mutex> lock(gStubMutex); for (GLsizei i = 0; i < n; i++) ids[i] = gStubNextName++; }
+void glDeleteQueries(GLsizei, const GLuint*) {}
+void glBeginQuery(GLenum, GLuint) {}
+void glEndQuery(GLenum) {}
+void glGetQueryObjectiv(GLuint, GLenum, GLint* params) { *params = GL_TRUE; }
+void glGetQueryObjectui64v(GLuint, GLenum, GLuint64* params) { *params = 0; }
+
+GLsync glFenceSync(GLenum, GLbitfield) { return (GLsync)1; }
+GLenum glClientWaitSync(GLsync, GLbitfield, GLuint64) { return GL_ALREADY_SIGNALED; }
+void glDeleteSync(GLsync) {}
+void glFinish() {}
+void glFlush() {}
+const GLubyte* glGetString(GLenum) { return (const GLubyte*)"ShaderSet stub GL"; }
+
+} // extern "C"
+
+//
+// Benchmark
+//
+
+struct BenchOptions
+{
+    int NumFiles = 200;
+    int NumPrograms = 1000;
+    int IdleUpdates = 1000;
+    bool Watch = false;
+    bool Async = false;
+    int Workers = 0;
+};
+
+// the shaders (vertex then fragment) of each program, and the number of programs using each file
+struct SyntheticTree
+{
+    std::vector<std::string> Files;
+    std::vector<std::vector<std::string>> Programs;
+    std::vector<std::vector<std::string>> ProgramDefines;
+    std::unordered_map<std::string, int> FileUsers;
+};
+
+static const char* kBenchDirectory = "shaderset_bench_files";
+
+static void WriteShaderFile(const std::string& filename, int edits)
+{
+    std::ofstream ofs(filename, std::ios::trunc);
+    ofs << "uniform vec4 uColor;\n";
+    // every edit makes the file longer, so the change is noticed even when the timestamp resolution is coarse
+    for (int i = 0; i < edits; i++)
+    {
+        ofs << "// edit\n";
+    }
+    ofs << "void main() {}\n";
+}
+
+static SyntheticTree GenerateTree(const BenchOptions& options)
+{
+#ifdef _WIN32
+    _mkdir(kBenchDirectory);
+#else
+    mkdir(kBenchDirectory, 0755);
+#endif
+
+    SyntheticTree tree;
+    int numVertex = std::max(1, options.NumFiles / 2);
+    int numFragment = std::max(1, options.NumFiles - numVertex);
+    for (int i = 0; i < numVertex; i++)
+    {
+        tree.Files.push_back(std::string(kBenchDirectory) + "/s" + std::to_string(i) + ".vert");
+    }
+    for (int i = 0; i < numFragment; i++)
+    {
+        tree.Files.push_back(std::string(kBenchDirectory) + "/s" + std::to_string(i) + ".frag");
+    }
+    for (const std::string& file : tree.Files)
+    {
+        WriteShaderFile(file, 0);
+    }
+
+    // every (vertex, fragment) pair once, then variants of the pairs with defines
+    for (int i = 0; i < options.NumPrograms; i++)
+    {
+        int pair = i % (numVertex * numFragment);
+        const std::string& vertex = tree.Files[pair % numVertex];
+        const std::string& fragment = tree.Files[numVertex + pair / numVertex];
+        tree.Programs.push_back({ vertex, fragment });
+        tree.ProgramDefines.push_back({});
+        if (i >= numVertex * numFragment)
+        {
+            tree.ProgramDefines.back().push_back("VARIANT " + std::to_string(i / (numVertex * numFragment)));
+        }
+        tree.FileUsers[vertex]++;
+        tree.FileUsers[fragment]++;
+    }
+    return tree;
+}
+
+struct UpdateCost
+{
+    uint64_t TotalTime = 0;
+    uint64_t MaxTime = 0;
+    int Calls = 0;
+};
+
+// updates until the expected number of programs were relinked (or a few seconds passed, eg. if the watcher missed the change)
+static UpdateCost UpdateUntilRelinked(ShaderSet& shaderSet, size_t expectedChanges)
+{
+    UpdateCost cost;
+    size_t changes = 0;
+    uint64_t giveUp = NowNanoseconds() + 5000000000ull;
+    while (changes < expectedChanges && NowNanoseconds() < giveUp)
+    {
+        uint64_t start = NowNanoseconds();
+        changes += shaderSet.UpdatePrograms().size();
+        uint64_t time = NowNanoseconds() - start;
+        cost.TotalTime += time;
+        cost.MaxTime = std::max(cost.MaxTime, time);
+        cost.Calls++;
+    }
+    if (changes < expectedChanges)
+    {
+        fprintf(stderr, "Only %zu of the %zu expected programs were relinked\n", changes, expectedChanges);
+    }
+    return cost;
+}
+
+static void PrintCost(const char* name, const UpdateCost& cost)
+{
+    printf("%-22s %10.3f ms total, %8d calls, %10.3f us per call, %10.3f us max\n", name,
+           cost.TotalTime / 1e6, cost.Calls, cost.Calls ? cost.TotalTime / 1e3 / cost.Calls : 0.0, cost.MaxTime / 1e3);
+}
+
+static bool ParseOption(int argc, char** argv, int& i, const char* name, int& value)
+{
+    if (strcmp(argv[i], name) != 0 || i + 1 >= argc)
+    {
+        return false;
+    }
+    value = atoi(argv[++i]);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        int latency;
+        if (ParseOption(argc, argv, i, "--files", options.NumFiles) ||
+            ParseOption(argc, argv, i, "--programs", options.NumPrograms) ||
+            ParseOption(argc, argv, i, "--idle-updates", options.IdleUpdates) ||
+            ParseOption(argc, argv, i, "--workers", options.Workers))
+        {
+            continue;
+        }
+        if (ParseOption(argc, argv, i, "--compile-us", latency))
+        {
+            gCompileLatency = (uint64_t)latency * 1000;
+        }
+        else if (ParseOption(argc, argv, i, "--link-us", latency))
+        {
+            gLinkLatency = (uint64_t)latency * 1000;
+        }
+        else if (strcmp(argv[i], "--watch") == 0)
+        {
+            options.Watch = true;
+        }
+        else if (strcmp(argv[i], "--async") == 0)
+        {
+            options.Async = true;
+        }
+        else
+        {
+            printf("usage: %s [--files N] [--programs M] [--idle-updates K] [--compile-us T] [--link-us T] [--watch] [--async] [--workers W]\n", argv[0]);
+            printf("  --files, --programs: size of the synthetic tree (half vertex shaders, half fragment shaders)\n");
+            printf("  --compile-us, --link-us: latency of the stub GL compiles and links, in microseconds\n");
+            printf("  --watch: use the native file watcher instead of polling timestamps\n");
+            printf("  --async: use SetAsyncCompilation(true)\n");
+            printf("  --workers: use SetWorkerThreads() with this many threads\n");
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    SyntheticTree tree = GenerateTree(options);
+    printf("%d files, %d programs, compile %llu us, link %llu us, %s, %s\n", (int)tree.Files.size(), (int)tree.Programs.size(),
+           (unsigned long long)(gCompileLatency / 1000), (unsigned long long)(gLinkLatency / 1000),
+           options.Watch ? "watching" : "polling", options.Workers ? "workers" : options.Async ? "async" : "sync");
+
+    uint64_t memoryBefore = PeakMemory();
+    {
+        ShaderSet shaderSet;
+        shaderSet.SetVersion("330");
+        if (options.Watch)
+        {
+            shaderSet.SetFileWatcher(CreateNativeShaderFileWatcher());
+        }
+        if (options.Async)
+        {
+            shaderSet.SetAsyncCompilation(true);
+        }
+        if (options.Workers)
+        {
+            // the stub GL doesn't need contexts
+            ShaderWorkerContextCallbacks callbacks;
+            callbacks.CreateContext = [] { return (void*)1; };
+            callbacks.MakeCurrent = [](void*) {};
+            callbacks.DestroyContext = [](void*) {};
+            shaderSet.SetWorkerThreads(options.Workers, callbacks);
+        }
+
+        uint64_t addStart = NowNanoseconds();
+        for (size_t i = 0; i < tree.Programs.size(); i++)
+        {
+            shaderSet.AddProgramFromExts(tree.Programs[i], tree.ProgramDefines[i]);
+        }
+        uint64_t addTime = NowNanoseconds() - addStart;
+        printf("%-22s %10.3f ms total, %10.0f programs per second\n", "AddProgram", addTime / 1e6, tree.Programs.size() / (addTime / 1e9));
+
+        PrintCost("first load", UpdateUntilRelinked(shaderSet, tree.Programs.size()));
+
+        UpdateCost idle;
+        for (int i = 0; i < options.IdleUpdates; i++)
+        {
+            uint64_t start = NowNanoseconds();
+            shaderSet.UpdatePrograms();
+            uint64_t time = NowNanoseconds() - start;
+            idle.TotalTime += time;
+            idle.MaxTime = std::max(idle.MaxTime, time);
+            idle.Calls++;
+        }
+        PrintCost("idle", idle);
+
+        WriteShaderFile(tree.Files[0], 1);
+        PrintCost("one file changed", UpdateUntilRelinked(shaderSet, tree.FileUsers[tree.Files[0]]));
+
+        for (const std::string& file : tree.Files)
+        {
+            WriteShaderFile(file, 2);
+        }
+        PrintCost("all files changed", UpdateUntilRelinked(shaderSet, tree.Programs.size()));
+
+        printf("%-22s %10.3f MB peak (%.3f MB before the ShaderSet was created)\n", "memory", PeakMemory() / 1e6, memoryBefore / 1e6);
+    }
+
+    for (const std::string& file : tree.Files)
+    {
+        remove(file.c_str());
+    }
+#ifdef _WIN32
+    _rmdir(kBenchDirectory);
+#else
+    rmdir(kBenchDirectory);
+#endif
+    return 0;
+}
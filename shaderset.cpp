@@ -2,27 +2,68 @@
 
 #ifdef _WIN32
 #include <sys/stat.h>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#pragma comment(lib, "ws2_32.lib")
 #else
 // Not Windows? Assume unix-like.
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+#include <sys/event.h>
+#define SHADERSET_KQUEUE
 #endif
 
 #include <string>
 #include <fstream>
 #include <cstdio>
 #include <algorithm>
+#include <map>
+#include <cerrno>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <cctype>
+
+// from GL_KHR_parallel_shader_compile, in case the GL header predates it
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
-static uint64_t GetShaderFileTimestamp(const char* filename)
+#ifndef GL_SHADER_BINARY_FORMAT_SPIR_V
+#define GL_SHADER_BINARY_FORMAT_SPIR_V 0x9551
+#endif
+
+// returns the modification time of a file in nanoseconds (or 0 if it can't be accessed), and its size.
+// The precision is as high as the file system allows, so that saves within the same second aren't missed.
+static uint64_t GetShaderFileTimestamp(const char* filename, uint64_t& fileSize)
 {
     uint64_t timestamp = 0;
+    fileSize = 0;
 
 #ifdef _WIN32
-    struct __stat64 stFileInfo;
-    if (_stat64(filename, &stFileInfo) == 0)
+    WIN32_FILE_ATTRIBUTE_DATA fileInfo;
+    if (GetFileAttributesExA(filename, GetFileExInfoStandard, &fileInfo))
     {
-        timestamp = stFileInfo.st_mtime;
+        // FILETIME is in 100 nanosecond intervals
+        timestamp = (((uint64_t)fileInfo.ftLastWriteTime.dwHighDateTime << 32) | fileInfo.ftLastWriteTime.dwLowDateTime) * 100;
+        fileSize = ((uint64_t)fileInfo.nFileSizeHigh << 32) | fileInfo.nFileSizeLow;
     }
 #else
     struct stat fileStat;
@@ -34,296 +75,4995 @@ static uint64_t GetShaderFileTimestamp(const char* filename)
     }
 
 #ifdef __APPLE__
-    timestamp = fileStat.st_mtimespec.tv_sec;
+    timestamp = (uint64_t)fileStat.st_mtimespec.tv_sec * 1000000000 + fileStat.st_mtimespec.tv_nsec;
 #else
-    timestamp = fileStat.st_mtime;
+    timestamp = (uint64_t)fileStat.st_mtim.tv_sec * 1000000000 + fileStat.st_mtim.tv_nsec;
 #endif
+    fileSize = (uint64_t)fileStat.st_size;
 #endif
 
     return timestamp;
 }
 
-static std::string ShaderStringFromFile(const char* filename)
+// time in nanoseconds, for measuring durations
+static uint64_t GetTimeNanoseconds()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// calls the scope hooks of an event sink (if any) around a block
+class ShaderSetEventScope
 {
-    std::ifstream fs(filename);
-    if (!fs)
+    ShaderSetEventSink* mSink;
+
+public:
+    ShaderSetEventScope(ShaderSetEventSink* sink, const char* name, const char* detail)
+        : mSink(sink)
     {
-        return "";
+        if (mSink)
+        {
+            mSink->BeginScope(name, detail);
+        }
     }
 
-    std::string s(
-        std::istreambuf_iterator<char>{fs},
-        std::istreambuf_iterator<char>{});
+    ~ShaderSetEventScope()
+    {
+        if (mSink)
+        {
+            mSink->EndScope();
+        }
+    }
 
-    return s;
-}
+    ShaderSetEventScope(const ShaderSetEventScope&) = delete;
+    ShaderSetEventScope& operator=(const ShaderSetEventScope&) = delete;
+};
 
-ShaderSet::~ShaderSet()
+// reads a whole file with a single read, reusing the memory already allocated by the string.
+// The contents are left empty if the file can't be read.
+static void ReadShaderFile(const char* filename, std::string& contents)
 {
-    for (std::pair<const ShaderNameTypePair, Shader>& shader : mShaders)
+    contents.clear();
+
+    FILE* file = fopen(filename, "rb");
+    if (!file)
     {
-        glDeleteShader(shader.second.Handle);
+        return;
     }
 
-    for (std::pair<const std::vector<const ShaderNameTypePair*>, Program>& program : mPrograms)
+    if (fseek(file, 0, SEEK_END) == 0)
     {
-        glDeleteProgram(program.second.InternalHandle);
+        long size = ftell(file);
+        if (size > 0 && fseek(file, 0, SEEK_SET) == 0)
+        {
+            contents.resize((size_t)size);
+            // the file might have been truncated since it was measured
+            contents.resize(fread(&contents[0], 1, contents.size(), file));
+        }
     }
+
+    fclose(file);
 }
 
-void ShaderSet::SetVersion(const std::string& version)
+// 64-bit xxHash (XXH64), used to identify shader sources.
+static const uint64_t kHashPrime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t kHashPrime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t kHashPrime3 = 0x165667B19E3779F9ULL;
+static const uint64_t kHashPrime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t kHashPrime5 = 0x27D4EB2F165667C5ULL;
+
+static uint64_t HashRotl(uint64_t x, int r)
 {
-    mVersion = version;
+    return (x << r) | (x >> (64 - r));
 }
 
-void ShaderSet::SetPreamble(const std::string& preamble)
+static uint64_t HashRead64(const unsigned char* p)
 {
-    mPreamble = preamble;
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
 }
 
-GLuint* ShaderSet::AddProgram(const std::vector<std::pair<std::string, GLenum>>& typedShaders)
+static uint32_t HashRead32(const unsigned char* p)
 {
-    std::vector<const ShaderNameTypePair*> shaderNameTypes;
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
 
-    // find references to existing shaders, and create ones that didn't exist previously.
-    for (const std::pair<std::string, GLenum>& shaderNameType : typedShaders)
-    {
-        ShaderNameTypePair tmpShaderNameType;
-        std::tie(tmpShaderNameType.Name, tmpShaderNameType.Type) = shaderNameType;
+static uint64_t HashRound(uint64_t acc, uint64_t input)
+{
+    acc += input * kHashPrime2;
+    acc = HashRotl(acc, 31);
+    return acc * kHashPrime1;
+}
 
-        // test that the file can be opened (to catch typos or missing file bugs)
-        {
-            std::ifstream ifs(tmpShaderNameType.Name);
-            if (!ifs)
-            {
-                fprintf(stderr, "Failed to open shader %s\n", tmpShaderNameType.Name.c_str());
-            }
-        }
+static uint64_t HashMergeRound(uint64_t acc, uint64_t val)
+{
+    acc ^= HashRound(0, val);
+    return acc * kHashPrime1 + kHashPrime4;
+}
 
-        auto foundShader = mShaders.emplace(std::move(tmpShaderNameType), Shader{}).first;
-        if (!foundShader->second.Handle)
+static uint64_t HashBytes(const void* data, size_t length, uint64_t seed)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + length;
+    uint64_t h64;
+
+    if (length >= 32)
+    {
+        uint64_t v1 = seed + kHashPrime1 + kHashPrime2;
+        uint64_t v2 = seed + kHashPrime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - kHashPrime1;
+        for (; p + 32 <= end; p += 32)
         {
-            foundShader->second.Handle = glCreateShader(shaderNameType.second);
-            // Mask the hash to 16 bits because some implementations are limited to that number of bits.
-            // The sign bit is masked out, since some shader compilers treat the #line as signed, and others treat it unsigned.
-            foundShader->second.HashName = (int32_t)std::hash<std::string>()(shaderNameType.first) & 0x7FFF;
+            v1 = HashRound(v1, HashRead64(p));
+            v2 = HashRound(v2, HashRead64(p + 8));
+            v3 = HashRound(v3, HashRead64(p + 16));
+            v4 = HashRound(v4, HashRead64(p + 24));
         }
-        shaderNameTypes.push_back(&foundShader->first);
+        h64 = HashRotl(v1, 1) + HashRotl(v2, 7) + HashRotl(v3, 12) + HashRotl(v4, 18);
+        h64 = HashMergeRound(h64, v1);
+        h64 = HashMergeRound(h64, v2);
+        h64 = HashMergeRound(h64, v3);
+        h64 = HashMergeRound(h64, v4);
+    }
+    else
+    {
+        h64 = seed + kHashPrime5;
     }
 
-    // ensure the programs have a canonical order
-    std::sort(begin(shaderNameTypes), end(shaderNameTypes));
-    shaderNameTypes.erase(std::unique(begin(shaderNameTypes), end(shaderNameTypes)), end(shaderNameTypes));
+    h64 += (uint64_t)length;
 
-    // find the program associated to these shaders (or create it if missing)
-    auto foundProgram = mPrograms.emplace(shaderNameTypes, Program{}).first;
-    if (!foundProgram->second.InternalHandle)
+    for (; p + 8 <= end; p += 8)
     {
-        // public handle is 0 until the program has linked without error
-        foundProgram->second.PublicHandle = 0;
-
-        foundProgram->second.InternalHandle = glCreateProgram();
-        for (const ShaderNameTypePair* shader : shaderNameTypes)
-        {
-            glAttachShader(foundProgram->second.InternalHandle, mShaders[*shader].Handle);
-        }
+        h64 ^= HashRound(0, HashRead64(p));
+        h64 = HashRotl(h64, 27) * kHashPrime1 + kHashPrime4;
+    }
+    if (p + 4 <= end)
+    {
+        h64 ^= (uint64_t)HashRead32(p) * kHashPrime1;
+        h64 = HashRotl(h64, 23) * kHashPrime2 + kHashPrime3;
+        p += 4;
+    }
+    for (; p < end; p++)
+    {
+        h64 ^= (*p) * kHashPrime5;
+        h64 = HashRotl(h64, 11) * kHashPrime1;
     }
 
-    return &foundProgram->second.PublicHandle;
+    h64 ^= h64 >> 33;
+    h64 *= kHashPrime2;
+    h64 ^= h64 >> 29;
+    h64 *= kHashPrime3;
+    h64 ^= h64 >> 32;
+    return h64;
 }
 
-void ShaderSet::UpdatePrograms()
+// splits a path into its directory and its file name, so the directory can be watched
+// (watching directories rather than files makes it possible to see editors that save by renaming a temporary file)
+static void SplitPath(const std::string& path, std::string& directory, std::string& filename)
 {
-    // find all shaders with updated timestamps
-    std::set<std::pair<const ShaderNameTypePair, Shader>*> updatedShaders;
-    for (std::pair<const ShaderNameTypePair, Shader>& shader : mShaders)
-    {
-        uint64_t timestamp = GetShaderFileTimestamp(shader.first.Name.c_str());
-        if (timestamp > shader.second.Timestamp)
-        {
-            shader.second.Timestamp = timestamp;
-            updatedShaders.insert(&shader);
-        }
-    }
-
-    // recompile all updated shaders
-    for (std::pair<const ShaderNameTypePair, Shader>* shader : updatedShaders)
-    {
-        // the #line prefix ensures error messages have the right line number for their file
-        // the #line directive also allows specifying a "file name" number, which makes it possible to identify which file the error came from.
-        std::string version = "#version " + mVersion + "\n";
-        
-        std::string defines;
-        switch (shader->first.Type) {
-        case GL_VERTEX_SHADER:          defines += "#define VERTEX_SHADER\n";             break;
-        case GL_FRAGMENT_SHADER:        defines += "#define FRAGMENT_SHADER\n";           break;
-        case GL_GEOMETRY_SHADER:        defines += "#define GEOMETRY_SHADER\n";           break;
-        case GL_TESS_CONTROL_SHADER:    defines += "#define TESS_CONTROL_SHADER\n";       break;
-        case GL_TESS_EVALUATION_SHADER: defines += "#define TESS_EVALUATION_SHADER\n";    break;
-        case GL_COMPUTE_SHADER:         defines += "#define COMPUTE_SHADER\n";            break;
-        }
-
-        std::string preamble_hash = std::to_string((int32_t)std::hash<std::string>()("preamble") & 0x7FFF);
-        std::string preamble = "#line 1 " + preamble_hash + "\n" + 
-                               mPreamble + "\n";
-        
-        std::string source_hash = std::to_string(shader->second.HashName);
-        std::string source = "#line 1 " + source_hash + "\n" + 
-                             ShaderStringFromFile(shader->first.Name.c_str()) + "\n";
-
-        const char* strings[] = {
-            version.c_str(),
-            defines.c_str(),
-            preamble.c_str(),
-            source.c_str()
-        };
-        GLint lengths[] = {
-            (GLint)version.length(),
-            (GLint)defines.length(),
-            (GLint)preamble.length(),
-            (GLint)source.length()
-        };
+    size_t slashLoc = path.find_last_of("/\\");
+    if (slashLoc == std::string::npos)
+    {
+        directory = ".";
+        filename = path;
+    }
+    else
+    {
+        directory = slashLoc == 0 ? path.substr(0, 1) : path.substr(0, slashLoc);
+        filename = path.substr(slashLoc + 1);
+    }
+}
 
-        glShaderSource(shader->second.Handle, sizeof(strings) / sizeof(*strings), strings, lengths);
-        glCompileShader(shader->second.Handle);
-            
-        GLint status;
-        glGetShaderiv(shader->second.Handle, GL_COMPILE_STATUS, &status);
-        if (!status)
+#if defined(__linux__)
+
+class InotifyShaderFileWatcher : public ShaderFileWatcher
+{
+    int mFd;
+    // maps directory names to inotify watch descriptors
+    std::map<std::string, int> mDirectories;
+    // maps watch descriptors to the file names in that directory and their name as passed to Watch()
+    std::map<int, std::multimap<std::string, std::string>> mFiles;
+
+public:
+    InotifyShaderFileWatcher(int fd) : mFd(fd) { }
+
+    ~InotifyShaderFileWatcher()
+    {
+        close(mFd);
+    }
+
+    bool Watch(const std::string& filename) override
+    {
+        std::string directory, name;
+        SplitPath(filename, directory, name);
+
+        auto foundDirectory = mDirectories.find(directory);
+        if (foundDirectory == mDirectories.end())
         {
-            GLint logLength;
-            glGetShaderiv(shader->second.Handle, GL_INFO_LOG_LENGTH, &logLength);
-            std::vector<char> log(logLength + 1);
-            glGetShaderInfoLog(shader->second.Handle, logLength, NULL, log.data());
-            
-            std::string log_s = log.data();
-            
-            // replace all filename hashes in the error messages with actual filenames
-            for (size_t found_preamble; (found_preamble = log_s.find(preamble_hash)) != std::string::npos;) {
-                log_s.replace(found_preamble, preamble_hash.size(), "preamble");
-            }
-            for (size_t found_source; (found_source = log_s.find(source_hash)) != std::string::npos;) {
-                log_s.replace(found_source, source_hash.size(), shader->first.Name);
+            int wd = inotify_add_watch(mFd, directory.c_str(), IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_MOVED_TO);
+            if (wd == -1)
+            {
+                perror(directory.c_str());
+                return false;
             }
+            foundDirectory = mDirectories.emplace(directory, wd).first;
+        }
 
-            fprintf(stderr, "Error compiling %s:\n%s\n", shader->first.Name.c_str(), log_s.c_str());
+        std::multimap<std::string, std::string>& files = mFiles[foundDirectory->second];
+        auto range = files.equal_range(name);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second == filename)
+            {
+                return true;
+            }
         }
+        files.emplace(std::move(name), filename);
+        return true;
     }
 
-    // relink all programs that had their shaders updated and have all their shaders compiling successfully
-    for (std::pair<const std::vector<const ShaderNameTypePair*>, Program>& program : mPrograms)
+    void PollChanges(std::vector<std::string>& changedFiles) override
     {
-        bool programNeedsRelink = false;
-        for (const ShaderNameTypePair* programShader : program.first)
+        alignas(struct inotify_event) char buffer[16384];
+        for (;;)
         {
-            for (std::pair<const ShaderNameTypePair, Shader>* shader : updatedShaders)
+            ssize_t length = read(mFd, buffer, sizeof(buffer));
+            if (length <= 0)
             {
-                if (&shader->first == programShader)
+                // EAGAIN means there are no events left to read
+                if (length == -1 && errno != EAGAIN && errno != EINTR)
                 {
-                    programNeedsRelink = true;
-                    break;
+                    perror("inotify");
                 }
-            }
-
-            if (programNeedsRelink)
                 break;
-        }
+            }
 
-        // Don't attempt to link shaders that didn't compile successfully
-        bool canRelink = true;
-        if (programNeedsRelink)
-        {
-            for (const ShaderNameTypePair* programShader : program.first)
+            for (char* p = buffer; p < buffer + length; )
             {
-                GLint status;
-                glGetShaderiv(mShaders[*programShader].Handle, GL_COMPILE_STATUS, &status);
-                if (!status)
+                const struct inotify_event* event = (const struct inotify_event*)p;
+                p += sizeof(struct inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW)
                 {
-                    canRelink = false;
-                    break;
+                    // events were lost, so any file could have changed
+                    for (const std::pair<const int, std::multimap<std::string, std::string>>& directory : mFiles)
+                    {
+                        for (const std::pair<const std::string, std::string>& file : directory.second)
+                        {
+                            changedFiles.push_back(file.second);
+                        }
+                    }
+                    continue;
+                }
+
+                if (event->len == 0)
+                {
+                    continue;
+                }
+
+                auto foundDirectory = mFiles.find(event->wd);
+                if (foundDirectory == mFiles.end())
+                {
+                    continue;
+                }
+
+                auto range = foundDirectory->second.equal_range(event->name);
+                for (auto it = range.first; it != range.second; ++it)
+                {
+                    changedFiles.push_back(it->second);
                 }
             }
         }
+    }
+};
+
+std::unique_ptr<ShaderFileWatcher> CreateNativeShaderFileWatcher()
+{
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1)
+    {
+        perror("inotify_init1");
+        return nullptr;
+    }
+    return std::unique_ptr<ShaderFileWatcher>(new InotifyShaderFileWatcher(fd));
+}
+
+#elif defined(_WIN32)
+
+class Win32ShaderFileWatcher : public ShaderFileWatcher
+{
+    struct Directory
+    {
+        HANDLE Handle;
+        OVERLAPPED Overlapped;
+        // ReadDirectoryChangesW requires a DWORD-aligned buffer
+        DWORD Buffer[4096];
+        // maps the file names in this directory to their name as passed to Watch()
+        std::multimap<std::string, std::string> Files;
+    };
+
+    std::map<std::string, std::unique_ptr<Directory>> mDirectories;
+
+    static bool IssueRead(Directory& directory)
+    {
+        return ReadDirectoryChangesW(
+            directory.Handle, directory.Buffer, sizeof(directory.Buffer), FALSE,
+            FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE,
+            NULL, &directory.Overlapped, NULL) != FALSE;
+    }
 
-        if (programNeedsRelink && canRelink)
+public:
+    ~Win32ShaderFileWatcher()
+    {
+        for (std::pair<const std::string, std::unique_ptr<Directory>>& directory : mDirectories)
         {
-            glLinkProgram(program.second.InternalHandle);
+            // the pending read must be finished before its buffer can be freed
+            DWORD bytes;
+            CancelIoEx(directory.second->Handle, &directory.second->Overlapped);
+            GetOverlappedResult(directory.second->Handle, &directory.second->Overlapped, &bytes, TRUE);
+            CloseHandle(directory.second->Overlapped.hEvent);
+            CloseHandle(directory.second->Handle);
+        }
+    }
 
-            GLint logLength;
-            glGetProgramiv(program.second.InternalHandle, GL_INFO_LOG_LENGTH, &logLength);
-            std::vector<char> log(logLength + 1);
-            glGetProgramInfoLog(program.second.InternalHandle, logLength, NULL, log.data());
+    bool Watch(const std::string& filename) override
+    {
+        std::string directoryName, name;
+        SplitPath(filename, directoryName, name);
 
-            std::string log_s = log.data();
+        auto foundDirectory = mDirectories.find(directoryName);
+        if (foundDirectory == mDirectories.end())
+        {
+            std::unique_ptr<Directory> directory(new Directory());
+            directory->Handle = CreateFileA(
+                directoryName.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+            if (directory->Handle == INVALID_HANDLE_VALUE)
+            {
+                fprintf(stderr, "Failed to watch directory %s\n", directoryName.c_str());
+                return false;
+            }
 
-            // replace all filename hashes in the error messages with actual filenames
-            std::string preamble_hash = std::to_string((int32_t)std::hash<std::string>()("preamble"));
-            for (size_t found_preamble; (found_preamble = log_s.find(preamble_hash)) != std::string::npos;) {
-                log_s.replace(found_preamble, preamble_hash.size(), "preamble");
+            directory->Overlapped.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+            if (!IssueRead(*directory))
+            {
+                fprintf(stderr, "Failed to watch directory %s\n", directoryName.c_str());
+                CloseHandle(directory->Overlapped.hEvent);
+                CloseHandle(directory->Handle);
+                return false;
             }
-            for (const ShaderNameTypePair* shaderInProgram : program.first)
+
+            foundDirectory = mDirectories.emplace(directoryName, std::move(directory)).first;
+        }
+
+        std::multimap<std::string, std::string>& files = foundDirectory->second->Files;
+        auto range = files.equal_range(name);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second == filename)
             {
-                std::string source_hash = std::to_string(mShaders[*shaderInProgram].HashName);
-                for (size_t found_source; (found_source = log_s.find(source_hash)) != std::string::npos;) {
-                    log_s.replace(found_source, source_hash.size(), shaderInProgram->Name);
-                }
+                return true;
             }
+        }
+        files.emplace(std::move(name), filename);
+        return true;
+    }
 
-            GLint status;
-            glGetProgramiv(program.second.InternalHandle, GL_LINK_STATUS, &status);
+    void PollChanges(std::vector<std::string>& changedFiles) override
+    {
+        for (std::pair<const std::string, std::unique_ptr<Directory>>& foundDirectory : mDirectories)
+        {
+            Directory& directory = *foundDirectory.second;
 
-            if (!status)
+            DWORD bytes;
+            if (!GetOverlappedResult(directory.Handle, &directory.Overlapped, &bytes, FALSE))
             {
-                fprintf(stderr, "Error linking");
+                // ERROR_IO_INCOMPLETE means nothing changed yet
+                continue;
             }
-            else
+
+            if (bytes == 0)
             {
-                fprintf(stderr, "Successfully linked");
+                // the notification buffer overflowed, so any file in the directory could have changed
+                for (const std::pair<const std::string, std::string>& file : directory.Files)
+                {
+                    changedFiles.push_back(file.second);
+                }
             }
 
-            fprintf(stderr, " program (");
-            for (const ShaderNameTypePair* shader : program.first)
+            for (const char* p = (const char*)directory.Buffer; bytes != 0; )
             {
-                if (shader != program.first.front())
+                const FILE_NOTIFY_INFORMATION* info = (const FILE_NOTIFY_INFORMATION*)p;
+
+                char name[MAX_PATH];
+                int nameLength = WideCharToMultiByte(CP_ACP, 0, info->FileName, info->FileNameLength / sizeof(WCHAR), name, sizeof(name), NULL, NULL);
+                auto range = directory.Files.equal_range(std::string(name, nameLength));
+                for (auto it = range.first; it != range.second; ++it)
+                {
+                    changedFiles.push_back(it->second);
+                }
+
+                if (info->NextEntryOffset == 0)
                 {
-                    fprintf(stderr, ", ");
+                    break;
                 }
+                p += info->NextEntryOffset;
+            }
 
-                fprintf(stderr, "%s", shader->Name.c_str());
+            ResetEvent(directory.Overlapped.hEvent);
+            if (!IssueRead(directory))
+            {
+                fprintf(stderr, "Failed to keep watching directory %s\n", foundDirectory.first.c_str());
             }
-            fprintf(stderr, ")");
-            if (log[0] != '\0')
+        }
+    }
+};
+
+std::unique_ptr<ShaderFileWatcher> CreateNativeShaderFileWatcher()
+{
+    return std::unique_ptr<ShaderFileWatcher>(new Win32ShaderFileWatcher());
+}
+
+#elif defined(SHADERSET_KQUEUE)
+
+class KqueueShaderFileWatcher : public ShaderFileWatcher
+{
+    int mKq;
+    // maps open file descriptors to the file name as passed to Watch()
+    std::map<int, std::string> mFiles;
+    // the file descriptor of each watched file name (-1 while it's waiting to be reopened), to find the files watched already
+    std::unordered_map<std::string, int> mFileDescriptors;
+    // files that were deleted or renamed (eg. by an editor's atomic save) and need to be opened again
+    std::vector<std::string> mFilesToReopen;
+
+    bool Open(const std::string& filename)
+    {
+#ifdef O_EVTONLY
+        int fd = open(filename.c_str(), O_EVTONLY);
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+#endif
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        struct kevent change;
+        EV_SET(&change, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME, 0, NULL);
+        if (kevent(mKq, &change, 1, NULL, 0, NULL) == -1)
+        {
+            close(fd);
+            return false;
+        }
+
+        mFiles.emplace(fd, filename);
+        mFileDescriptors[filename] = fd;
+        return true;
+    }
+
+public:
+    KqueueShaderFileWatcher(int kq) : mKq(kq) { }
+
+    ~KqueueShaderFileWatcher()
+    {
+        for (const std::pair<const int, std::string>& file : mFiles)
+        {
+            close(file.first);
+        }
+        close(mKq);
+    }
+
+    bool Watch(const std::string& filename) override
+    {
+        if (mFileDescriptors.count(filename))
+        {
+            return true;
+        }
+
+        if (!Open(filename))
+        {
+            perror(filename.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void PollChanges(std::vector<std::string>& changedFiles) override
+    {
+        // try to reopen the files that were replaced since the last poll
+        for (auto it = mFilesToReopen.begin(); it != mFilesToReopen.end(); )
+        {
+            if (Open(*it))
             {
-                fprintf(stderr, ":\n%s\n", log_s.c_str());
+                changedFiles.push_back(*it);
+                it = mFilesToReopen.erase(it);
             }
             else
             {
-                fprintf(stderr, "\n");
+                ++it;
             }
+        }
 
-            if (!status)
+        struct timespec timeout = { 0, 0 };
+        struct kevent events[64];
+        for (;;)
+        {
+            int numEvents = kevent(mKq, NULL, 0, events, sizeof(events) / sizeof(*events), &timeout);
+            if (numEvents <= 0)
             {
-                program.second.PublicHandle = 0;
+                break;
             }
-            else
+
+            for (int i = 0; i < numEvents; i++)
+            {
+                int fd = (int)events[i].ident;
+                auto foundFile = mFiles.find(fd);
+                if (foundFile == mFiles.end())
+                {
+                    continue;
+                }
+
+                changedFiles.push_back(foundFile->second);
+
+                if (events[i].fflags & (NOTE_DELETE | NOTE_RENAME))
+                {
+                    // the watched file is gone, so watch whatever file replaces it
+                    std::string filename = std::move(foundFile->second);
+                    mFiles.erase(foundFile);
+                    close(fd);
+                    if (Open(filename))
+                    {
+                        changedFiles.push_back(filename);
+                    }
+                    else
+                    {
+                        mFileDescriptors[filename] = -1;
+                        mFilesToReopen.push_back(std::move(filename));
+                    }
+                }
+            }
+
+            if (numEvents < (int)(sizeof(events) / sizeof(*events)))
             {
-                program.second.PublicHandle = program.second.InternalHandle;
+                break;
             }
         }
     }
+};
+
+std::unique_ptr<ShaderFileWatcher> CreateNativeShaderFileWatcher()
+{
+    int kq = kqueue();
+    if (kq == -1)
+    {
+        perror("kqueue");
+        return nullptr;
+    }
+    return std::unique_ptr<ShaderFileWatcher>(new KqueueShaderFileWatcher(kq));
 }
 
-void ShaderSet::SetPreambleFile(const std::string& preambleFilename)
+#else
+
+std::unique_ptr<ShaderFileWatcher> CreateNativeShaderFileWatcher()
+{
+    return nullptr;
+}
+
+#endif
+
+#ifdef _WIN32
+using ShaderSocket = SOCKET;
+static const ShaderSocket kInvalidSocket = INVALID_SOCKET;
+
+static void CloseSocket(ShaderSocket s)
 {
-    SetPreamble(ShaderStringFromFile(preambleFilename.c_str()));
+    closesocket(s);
 }
 
-GLuint* ShaderSet::AddProgramFromExts(const std::vector<std::string>& shaders)
+static bool SetSocketNonBlocking(ShaderSocket s)
 {
-    std::vector<std::pair<std::string, GLenum>> typedShaders;
-    for (const std::string& shader : shaders)
+    u_long nonBlocking = 1;
+    return ioctlsocket(s, FIONBIO, &nonBlocking) == 0;
+}
+
+static bool SocketWouldBlock()
+{
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+#else
+using ShaderSocket = int;
+static const ShaderSocket kInvalidSocket = -1;
+
+static void CloseSocket(ShaderSocket s)
+{
+    close(s);
+}
+
+static bool SetSocketNonBlocking(ShaderSocket s)
+{
+    int flags = fcntl(s, F_GETFL, 0);
+    return flags != -1 && fcntl(s, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+static bool SocketWouldBlock()
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+#endif
+
+// a file sent by a ShaderRemoteSender is a header, the file name, and the bytes that differ from the previous contents sent for that file,
+// compressed (see CompressRemoteBytes). All integers are little-endian.
+struct ShaderRemoteFileHeader
+{
+    uint32_t Magic;
+    uint32_t NameLength;
+    // the number of bytes at the start and at the end that are the same as in the previous contents
+    uint32_t PrefixLength;
+    uint32_t SuffixLength;
+    // the number of bytes between the prefix and the suffix, and the number of compressed bytes encoding them, which follow the name
+    uint32_t MiddleLength;
+    uint32_t CompressedLength;
+    // hash of the whole new contents, to detect the sender and receiver disagreeing on the previous contents
+    uint64_t Hash;
+};
+
+static const uint32_t kShaderRemoteFileMagic = 0x32525353; // "SSR2"
+static const size_t kShaderRemoteFileHeaderSize = 32;
+// larger sizes can only come from a corrupted stream
+static const uint32_t kMaxShaderRemoteNameLength = 4096;
+static const uint32_t kMaxShaderRemoteFileLength = 256 * 1024 * 1024;
+
+static void WriteLittleEndian(std::string& out, uint64_t value, int size)
+{
+    for (int i = 0; i < size; i++)
+    {
+        out.push_back((char)((value >> (i * 8)) & 0xFF));
+    }
+}
+
+static uint64_t ReadLittleEndian(const char* in, int size)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < size; i++)
+    {
+        value |= (uint64_t)(unsigned char)in[i] << (i * 8);
+    }
+    return value;
+}
+
+// LEB128 variable-length integers, 7 bits per byte
+static void WriteVarint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((char)((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+static bool ReadVarint(const char* in, size_t length, size_t& offset, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && offset < length; shift += 7)
+    {
+        unsigned char byte = (unsigned char)in[offset++];
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// compresses the bytes of contents between start and end as LZ77 tokens: (length << 1) followed by that many literal bytes,
+// or (length << 1 | 1) followed by the distance back to the bytes to repeat. Matches can start in the bytes before start,
+// since the receiver has them already, so code moved within a file or repeated from the unchanged prefix costs a few bytes.
+static void CompressRemoteBytes(const std::string& contents, size_t start, size_t end, std::string& out)
+{
+    static const size_t kMinMatchLength = 4;
+    static const int kHashBits = 14;
+    static const uint32_t kNoPosition = UINT32_MAX;
+
+    // the last position of each hashed 4-byte sequence
+    std::vector<uint32_t> positions((size_t)1 << kHashBits, kNoPosition);
+    auto hash = [&contents](size_t i)
+    {
+        uint32_t bytes;
+        memcpy(&bytes, contents.data() + i, sizeof(bytes));
+        return (bytes * 2654435761u) >> (32 - kHashBits);
+    };
+
+    for (size_t i = 0; i < start && i + kMinMatchLength <= contents.size(); i++)
     {
-        size_t extLoc = shader.find_last_of('.');
+        positions[hash(i)] = (uint32_t)i;
+    }
+
+    size_t literalStart = start;
+    auto writeLiterals = [&](size_t literalEnd)
+    {
+        if (literalEnd > literalStart)
+        {
+            WriteVarint(out, (uint64_t)(literalEnd - literalStart) << 1);
+            out.append(contents, literalStart, literalEnd - literalStart);
+        }
+    };
+
+    size_t i = start;
+    while (i + kMinMatchLength <= end)
+    {
+        uint32_t h = hash(i);
+        uint32_t candidate = positions[h];
+        positions[h] = (uint32_t)i;
+        if (candidate == kNoPosition || memcmp(contents.data() + candidate, contents.data() + i, kMinMatchLength) != 0)
+        {
+            i++;
+            continue;
+        }
+
+        size_t matchLength = kMinMatchLength;
+        while (i + matchLength < end && contents[candidate + matchLength] == contents[i + matchLength])
+        {
+            matchLength++;
+        }
+
+        writeLiterals(i);
+        WriteVarint(out, (uint64_t)matchLength << 1 | 1);
+        WriteVarint(out, i - candidate);
+        i += matchLength;
+        literalStart = i;
+    }
+    writeLiterals(end);
+}
+
+// appends the length bytes encoded by CompressRemoteBytes to contents, which holds the bytes before them. Returns false if the tokens are corrupted.
+static bool DecompressRemoteBytes(const char* in, size_t inLength, size_t length, std::string& contents)
+{
+    size_t end = contents.size() + length;
+    size_t offset = 0;
+    while (contents.size() < end)
+    {
+        uint64_t token;
+        if (!ReadVarint(in, inLength, offset, token))
+        {
+            return false;
+        }
+
+        uint64_t runLength = token >> 1;
+        if (runLength == 0 || runLength > end - contents.size())
+        {
+            return false;
+        }
+
+        if (token & 1)
+        {
+            uint64_t distance;
+            if (!ReadVarint(in, inLength, offset, distance) || distance == 0 || distance > contents.size())
+            {
+                return false;
+            }
+            // byte by byte, since the match can overlap the bytes it produces
+            size_t from = contents.size() - (size_t)distance;
+            for (uint64_t i = 0; i < runLength; i++)
+            {
+                char byte = contents[from + (size_t)i];
+                contents.push_back(byte);
+            }
+        }
+        else
+        {
+            if (runLength > inLength - offset)
+            {
+                return false;
+            }
+            contents.append(in + offset, (size_t)runLength);
+            offset += (size_t)runLength;
+        }
+    }
+    return offset == inLength;
+}
+
+class SocketShaderRemoteSource : public ShaderRemoteSource
+{
+    ShaderSocket mListener;
+    ShaderSocket mClient = kInvalidSocket;
+    // bytes received that don't make a whole file yet
+    std::string mReceived;
+    // the contents received for each file over the current connection, which the deltas apply to
+    std::unordered_map<std::string, std::string> mFiles;
+
+    void Disconnect()
+    {
+        CloseSocket(mClient);
+        mClient = kInvalidSocket;
+        mReceived.clear();
+        mFiles.clear();
+    }
+
+    // returns false if the stream is corrupted
+    bool ParseFiles(std::vector<std::pair<std::string, std::string>>& files)
+    {
+        size_t offset = 0;
+        while (mReceived.size() - offset >= kShaderRemoteFileHeaderSize)
+        {
+            const char* data = mReceived.data() + offset;
+            ShaderRemoteFileHeader header;
+            header.Magic = (uint32_t)ReadLittleEndian(data, 4);
+            header.NameLength = (uint32_t)ReadLittleEndian(data + 4, 4);
+            header.PrefixLength = (uint32_t)ReadLittleEndian(data + 8, 4);
+            header.SuffixLength = (uint32_t)ReadLittleEndian(data + 12, 4);
+            header.MiddleLength = (uint32_t)ReadLittleEndian(data + 16, 4);
+            header.CompressedLength = (uint32_t)ReadLittleEndian(data + 20, 4);
+            header.Hash = ReadLittleEndian(data + 24, 8);
+            if (header.Magic != kShaderRemoteFileMagic || header.NameLength > kMaxShaderRemoteNameLength ||
+                header.MiddleLength > kMaxShaderRemoteFileLength || header.CompressedLength > kMaxShaderRemoteFileLength)
+            {
+                return false;
+            }
+
+            size_t fileSize = kShaderRemoteFileHeaderSize + header.NameLength + header.CompressedLength;
+            if (mReceived.size() - offset < fileSize)
+            {
+                break;
+            }
+
+            std::string name(data + kShaderRemoteFileHeaderSize, header.NameLength);
+            const char* middle = data + kShaderRemoteFileHeaderSize + header.NameLength;
+            offset += fileSize;
+
+            std::string& previous = mFiles[name];
+            if ((uint64_t)header.PrefixLength + header.SuffixLength > previous.size())
+            {
+                return false;
+            }
+            std::string contents;
+            contents.reserve(header.PrefixLength + header.MiddleLength + header.SuffixLength);
+            contents.append(previous, 0, header.PrefixLength);
+            if (!DecompressRemoteBytes(middle, header.CompressedLength, header.MiddleLength, contents))
+            {
+                return false;
+            }
+            contents.append(previous, previous.size() - header.SuffixLength, header.SuffixLength);
+            if (HashBytes(contents.data(), contents.size(), 0) != header.Hash)
+            {
+                return false;
+            }
+
+            previous = contents;
+            files.emplace_back(std::move(name), std::move(contents));
+        }
+        mReceived.erase(0, offset);
+        return true;
+    }
+
+public:
+    explicit SocketShaderRemoteSource(ShaderSocket listener)
+        : mListener(listener)
+    { }
+
+    ~SocketShaderRemoteSource()
+    {
+        if (mClient != kInvalidSocket)
+        {
+            CloseSocket(mClient);
+        }
+        CloseSocket(mListener);
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+
+    void PollFiles(std::vector<std::pair<std::string, std::string>>& files) override
+    {
+        if (mClient == kInvalidSocket)
+        {
+            mClient = accept(mListener, NULL, NULL);
+            if (mClient == kInvalidSocket)
+            {
+                return;
+            }
+            if (!SetSocketNonBlocking(mClient))
+            {
+                Disconnect();
+                return;
+            }
+        }
+
+        char buffer[64 * 1024];
+        for (;;)
+        {
+            int received = (int)recv(mClient, buffer, sizeof(buffer), 0);
+            if (received > 0)
+            {
+                mReceived.append(buffer, received);
+                continue;
+            }
+            if (received < 0 && SocketWouldBlock())
+            {
+                break;
+            }
+            // the sender disconnected, and the next one starts over with whole files
+            ParseFiles(files);
+            Disconnect();
+            return;
+        }
+
+        if (!ParseFiles(files))
+        {
+            fprintf(stderr, "Received corrupted shader files from the remote sender, disconnecting it\n");
+            Disconnect();
+        }
+    }
+};
+
+std::unique_ptr<ShaderRemoteSource> CreateSocketShaderRemoteSource(uint16_t port, const std::string& bindAddress)
+{
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+    {
+        fprintf(stderr, "WSAStartup failed\n");
+        return nullptr;
+    }
+#endif
+
+    // listen on the first of the addresses bindAddress resolves to that can be bound
+    ShaderSocket listener = kInvalidSocket;
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(bindAddress.c_str(), std::to_string(port).c_str(), &hints, &addresses) == 0)
+    {
+        for (addrinfo* address = addresses; address; address = address->ai_next)
+        {
+            ShaderSocket s = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (s == kInvalidSocket)
+            {
+                continue;
+            }
+
+            int reuse = 1;
+            setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+            if (bind(s, address->ai_addr, (int)address->ai_addrlen) == 0 && listen(s, 1) == 0 && SetSocketNonBlocking(s))
+            {
+                listener = s;
+                break;
+            }
+            CloseSocket(s);
+        }
+        freeaddrinfo(addresses);
+    }
+
+    if (listener == kInvalidSocket)
+    {
+        fprintf(stderr, "Failed to listen for remote shader files on %s:%u\n", bindAddress.c_str(), (unsigned)port);
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return nullptr;
+    }
+
+    return std::unique_ptr<ShaderRemoteSource>(new SocketShaderRemoteSource(listener));
+}
+
+ShaderRemoteSender::~ShaderRemoteSender()
+{
+    if (mSocket != -1)
+    {
+        CloseSocket((ShaderSocket)mSocket);
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+}
+
+bool ShaderRemoteSender::Connect(const std::string& host, uint16_t port)
+{
+    if (mSocket != -1)
+    {
+        CloseSocket((ShaderSocket)mSocket);
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        mSocket = -1;
+    }
+    // the receiver forgets the previous contents when a connection ends, so everything is sent whole again
+    mSentFiles.clear();
+
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+    {
+        return false;
+    }
+#endif
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) == 0)
+    {
+        for (addrinfo* address = addresses; address; address = address->ai_next)
+        {
+            ShaderSocket s = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (s == kInvalidSocket)
+            {
+                continue;
+            }
+            if (connect(s, address->ai_addr, (int)address->ai_addrlen) == 0)
+            {
+                mSocket = (intptr_t)s;
+                break;
+            }
+            CloseSocket(s);
+        }
+        freeaddrinfo(addresses);
+    }
+
+    if (mSocket == -1)
+    {
+        fprintf(stderr, "Failed to connect to %s:%u to send shader files\n", host.c_str(), (unsigned)port);
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return false;
+    }
+    return true;
+}
+
+bool ShaderRemoteSender::SendFile(const std::string& filename, const std::string& contents)
+{
+    if (mSocket == -1)
+    {
+        return false;
+    }
+
+    // send only what's between the prefix and the suffix shared with the previous contents
+    std::string& previous = mSentFiles[filename];
+    size_t maxShared = std::min(previous.size(), contents.size());
+    size_t prefixLength = 0;
+    while (prefixLength < maxShared && previous[prefixLength] == contents[prefixLength])
+    {
+        prefixLength++;
+    }
+    size_t suffixLength = 0;
+    while (suffixLength < maxShared - prefixLength && previous[previous.size() - 1 - suffixLength] == contents[contents.size() - 1 - suffixLength])
+    {
+        suffixLength++;
+    }
+    size_t middleLength = contents.size() - prefixLength - suffixLength;
+
+    std::string compressed;
+    CompressRemoteBytes(contents, prefixLength, prefixLength + middleLength, compressed);
+
+    std::string message;
+    message.reserve(kShaderRemoteFileHeaderSize + filename.size() + compressed.size());
+    WriteLittleEndian(message, kShaderRemoteFileMagic, 4);
+    WriteLittleEndian(message, filename.size(), 4);
+    WriteLittleEndian(message, prefixLength, 4);
+    WriteLittleEndian(message, suffixLength, 4);
+    WriteLittleEndian(message, middleLength, 4);
+    WriteLittleEndian(message, compressed.size(), 4);
+    WriteLittleEndian(message, HashBytes(contents.data(), contents.size(), 0), 8);
+    message += filename;
+    message += compressed;
+
+#ifdef MSG_NOSIGNAL
+    // report a lost connection as an error instead of getting killed by SIGPIPE
+    int flags = MSG_NOSIGNAL;
+#else
+    int flags = 0;
+#endif
+    for (size_t sent = 0; sent < message.size(); )
+    {
+        int result = (int)send((ShaderSocket)mSocket, message.data() + sent, (int)std::min(message.size() - sent, (size_t)1 << 20), flags);
+        if (result <= 0)
+        {
+            fprintf(stderr, "Lost the connection while sending shader file %s\n", filename.c_str());
+            CloseSocket((ShaderSocket)mSocket);
+#ifdef _WIN32
+            WSACleanup();
+#endif
+            mSocket = -1;
+            return false;
+        }
+        sent += result;
+    }
+
+    previous = contents;
+    return true;
+}
+
+static std::string GetShaderLog(GLuint shader)
+{
+    GLint logLength;
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+    std::vector<char> log(logLength + 1);
+    glGetShaderInfoLog(shader, logLength, NULL, log.data());
+    return log.data();
+}
+
+static std::string GetProgramLog(GLuint program)
+{
+    GLint logLength;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
+    std::vector<char> log(logLength + 1);
+    glGetProgramInfoLog(program, logLength, NULL, log.data());
+    return log.data();
+}
+
+// the #line prefix ensures error messages have the right line number for their file
+// the #line directive also allows specifying a "file name" number, which makes it possible to identify which file the error came from.
+static void SetShaderSource(GLuint shader, const std::string& header, const std::string& defines, const std::string& constants, int32_t fileNumber, const std::string& source)
+{
+    char lineDirective[32];
+    snprintf(lineDirective, sizeof(lineDirective), "#line 1 %d\n", (int)fileNumber);
+
+    // passed as separate strings so the header and source don't need to be concatenated (nor copied for each constant variant)
+    const char* strings[] = { header.c_str(), defines.c_str(), constants.c_str(), lineDirective, source.c_str(), "\n" };
+    GLint lengths[] = { (GLint)header.length(), (GLint)defines.length(), (GLint)constants.length(), (GLint)strlen(lineDirective), (GLint)source.length(), 1 };
+
+    glShaderSource(shader, sizeof(strings) / sizeof(*strings), strings, lengths);
+}
+
+// the hash of a constant variant is the hash of the rest of its source, extended with its constants (if it has any)
+static uint64_t HashConstants(const std::string& constantsSource, uint64_t sourceHash)
+{
+    return constantsSource.empty() ? sourceHash : HashBytes(constantsSource.data(), constantsSource.size(), sourceHash);
+}
+
+static bool EndsWith(const std::string& s, const char* suffix)
+{
+    size_t length = strlen(suffix);
+    return s.size() >= length && s.compare(s.size() - length, length, suffix) == 0;
+}
+
+// finds the constant IDs of the named specialization constants of a SPIR-V module, from its OpName and OpDecorate SpecId instructions.
+// Constants it doesn't have (or whose names were stripped) are left out, like defines the GLSL doesn't use.
+static void FindSpecializationConstants(const void* spirv, size_t size, const ShaderConstants& constants, std::vector<GLuint>& indices, std::vector<GLuint>& values)
+{
+    const uint32_t kSpirvMagic = 0x07230203;
+    const uint32_t kOpName = 5;
+    const uint32_t kOpDecorate = 71;
+    const uint32_t kDecorationSpecId = 1;
+
+    // the binary is in a std::string, so words are copied out of it rather than read in place
+    size_t numWords = size / sizeof(uint32_t);
+    auto word = [spirv](size_t i)
+    {
+        uint32_t w;
+        memcpy(&w, (const char*)spirv + i * sizeof(uint32_t), sizeof(w));
+        return w;
+    };
+    if (numWords < 5 || word(0) != kSpirvMagic)
+    {
+        return;
+    }
+
+    std::unordered_map<uint32_t, std::string> names;
+    std::unordered_map<uint32_t, uint32_t> specIDs;
+    for (size_t i = 5; i < numWords; )
+    {
+        uint32_t opcode = word(i) & 0xFFFF;
+        uint32_t wordCount = word(i) >> 16;
+        if (wordCount == 0 || i + wordCount > numWords)
+        {
+            break;
+        }
+
+        if (opcode == kOpName && wordCount >= 3)
+        {
+            const char* name = (const char*)spirv + (i + 2) * sizeof(uint32_t);
+            size_t maxLength = (wordCount - 2) * sizeof(uint32_t);
+            names[word(i + 1)].assign(name, strnlen(name, maxLength));
+        }
+        else if (opcode == kOpDecorate && wordCount >= 4 && word(i + 2) == kDecorationSpecId)
+        {
+            specIDs[word(i + 1)] = word(i + 3);
+        }
+
+        i += wordCount;
+    }
+
+    for (const auto& specID : specIDs)
+    {
+        auto foundName = names.find(specID.first);
+        if (foundName == names.end())
+        {
+            continue;
+        }
+        auto foundConstant = std::lower_bound(constants.begin(), constants.end(), foundName->second,
+            [](const std::pair<std::string, int32_t>& constant, const std::string& name) { return constant.first < name; });
+        if (foundConstant != constants.end() && foundConstant->first == foundName->second)
+        {
+            indices.push_back(specID.second);
+            values.push_back((GLuint)foundConstant->second);
+        }
+    }
+}
+
+// loads SPIR-V into a shader, which is "compiled" by specializing it (with the constants, sorted by name)
+static void SetShaderSpirv(GLuint shader, const void* spirv, size_t size, const ShaderConstants& constants)
+{
+    std::vector<GLuint> indices;
+    std::vector<GLuint> values;
+    if (!constants.empty())
+    {
+        FindSpecializationConstants(spirv, size, constants, indices, values);
+    }
+
+    glShaderBinary(1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V, spirv, (GLsizei)size);
+    glSpecializeShader(shader, "main", (GLuint)indices.size(), indices.data(), values.data());
+}
+
+// translates GLSL to SPIR-V and loads it into a shader, unless the translation was already cached.
+// Returns false with the log of the translator if it failed, in which case the shader is left as-is.
+static bool TranslateShaderToSpirv(GLuint shader, GLenum type, const ShaderSpirvCompiler& compiler, const std::string& cacheFilename,
+                                   const std::string& header, const std::string& defines, int32_t fileNumber, const std::string& source,
+                                   const ShaderConstants& constants, std::string& log)
+{
+    std::string cached;
+    if (!cacheFilename.empty())
+    {
+        ReadShaderFile(cacheFilename.c_str(), cached);
+    }
+    if (!cached.empty())
+    {
+        SetShaderSpirv(shader, cached.data(), cached.size(), constants);
+        return true;
+    }
+
+    // the translator takes a single string, unlike glShaderSource
+    char lineDirective[32];
+    snprintf(lineDirective, sizeof(lineDirective), "#line 1 %d\n", (int)fileNumber);
+    std::string glsl;
+    glsl.reserve(header.size() + defines.size() + strlen(lineDirective) + source.size() + 1);
+    glsl += header;
+    glsl += defines;
+    glsl += lineDirective;
+    glsl += source;
+    glsl += "\n";
+
+    std::vector<uint32_t> spirv;
+    if (!compiler(glsl, type, spirv, log))
+    {
+        return false;
+    }
+
+    if (!cacheFilename.empty())
+    {
+        std::ofstream ofs(cacheFilename, std::ios::binary | std::ios::trunc);
+        if (!ofs.write((const char*)spirv.data(), spirv.size() * sizeof(uint32_t)))
+        {
+            fprintf(stderr, "Failed to write SPIR-V cache file %s\n", cacheFilename.c_str());
+        }
+    }
+
+    SetShaderSpirv(shader, spirv.data(), spirv.size() * sizeof(uint32_t), constants);
+    return true;
+}
+
+struct ShaderSet::WorkerJob
+{
+    enum JobType { ReadFile, Compile, Link } Type;
+
+    // inputs of ReadFile
+    std::string Filename;
+    // inputs of Compile
+    ShaderHandle Shader = 0;
+    std::shared_ptr<const std::string> SourceHeader;
+    std::string Defines;
+    ShaderConstants Constants;
+    std::string ConstantsSource;
+    int32_t FileNumber = 0;
+    std::string Source;
+    GLenum ShaderType = 0;
+    bool Spirv = false;
+    ShaderSpirvCompiler SpirvCompiler;
+    std::string SpirvCacheFilename;
+    // inputs of Link
+    std::vector<ShaderHandle> Shaders;
+    bool BinaryRetrievable = false;
+    bool Separable = false;
+
+    // outputs of ReadFile
+    std::string Contents;
+    // outputs of Compile and Link
+    GLint Status = 0;
+    std::string Log;
+    // outputs of Link. The fence signals when the linked program can be used by other contexts.
+    ProgramHandle Program = 0;
+    GLsync Fence = 0;
+
+    // time taken by the job on the worker thread
+    uint64_t Duration = 0;
+
+    // set by the worker thread once the outputs are written
+    std::atomic<bool> Done{ false };
+
+    void Run()
+    {
+        uint64_t start = GetTimeNanoseconds();
+
+        switch (Type)
+        {
+        case ReadFile:
+            ReadShaderFile(Filename.c_str(), Contents);
+            break;
+        case Compile:
+        {
+            if (Spirv)
+            {
+                SetShaderSpirv(Shader, Source.data(), Source.size(), Constants);
+            }
+            else if (SpirvCompiler)
+            {
+                if (!TranslateShaderToSpirv(Shader, ShaderType, SpirvCompiler, SpirvCacheFilename, *SourceHeader, Defines, FileNumber, Source, Constants, Log))
+                {
+                    Status = 0;
+                    break;
+                }
+            }
+            else
+            {
+                SetShaderSource(Shader, *SourceHeader, Defines, ConstantsSource, FileNumber, Source);
+                glCompileShader(Shader);
+            }
+            glGetShaderiv(Shader, GL_COMPILE_STATUS, &Status);
+            if (!Status)
+            {
+                Log = GetShaderLog(Shader);
+            }
+            // the compile must be complete before another context's link can see it
+            glFinish();
+            break;
+        }
+        case Link:
+            Program = glCreateProgram();
+            for (ShaderHandle shader : Shaders)
+            {
+                glAttachShader(Program, shader);
+            }
+            if (BinaryRetrievable)
+            {
+                glProgramParameteri(Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+            }
+            if (Separable)
+            {
+                glProgramParameteri(Program, GL_PROGRAM_SEPARABLE, GL_TRUE);
+            }
+            glLinkProgram(Program);
+            glGetProgramiv(Program, GL_LINK_STATUS, &Status);
+            Log = GetProgramLog(Program);
+            Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+            break;
+        }
+
+        Duration = GetTimeNanoseconds() - start;
+        Done.store(true, std::memory_order_release);
+    }
+};
+
+struct ShaderSet::WorkerPool
+{
+    ShaderWorkerContextCallbacks Callbacks;
+    std::vector<void*> Contexts;
+    std::vector<std::thread> Threads;
+
+    std::mutex Mutex;
+    std::condition_variable JobAdded;
+    std::deque<std::shared_ptr<WorkerJob>> Jobs;
+    bool Stopping = false;
+
+    WorkerPool(int numThreads, const ShaderWorkerContextCallbacks& callbacks)
+        : Callbacks(callbacks)
+    {
+        for (int i = 0; i < numThreads; i++)
+        {
+            void* context = Callbacks.CreateContext();
+            if (!context)
+            {
+                fprintf(stderr, "Failed to create the GL context of shader worker thread %d\n", i);
+                break;
+            }
+            Contexts.push_back(context);
+            Threads.emplace_back(&WorkerPool::WorkerMain, this, context);
+        }
+    }
+
+    ~WorkerPool()
+    {
+        // the workers finish the jobs already submitted before they exit, so nothing is left waiting forever.
+        {
+            std::lock_guard<std::mutex> lock(Mutex);
+            Stopping = true;
+        }
+        JobAdded.notify_all();
+
+        for (std::thread& thread : Threads)
+        {
+            thread.join();
+        }
+        for (void* context : Contexts)
+        {
+            Callbacks.DestroyContext(context);
+        }
+    }
+
+    void Submit(std::shared_ptr<WorkerJob> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(Mutex);
+            Jobs.push_back(std::move(job));
+        }
+        JobAdded.notify_one();
+    }
+
+    void WorkerMain(void* context)
+    {
+        Callbacks.MakeCurrent(context);
+
+        for (;;)
+        {
+            std::shared_ptr<WorkerJob> job;
+            {
+                std::unique_lock<std::mutex> lock(Mutex);
+                JobAdded.wait(lock, [this] { return Stopping || !Jobs.empty(); });
+                if (Jobs.empty())
+                {
+                    break;
+                }
+                job = std::move(Jobs.front());
+                Jobs.pop_front();
+            }
+            job->Run();
+        }
+
+        Callbacks.MakeCurrent(nullptr);
+    }
+};
+
+// true once a link done by a worker thread is finished and visible to the current context
+static bool IsWorkerLinkDone(GLsync fence)
+{
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    return result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED;
+}
+
+// the layout of archive files (see ShaderSet::WriteArchive): a header, followed by the entries, followed by the names and data of the entries.
+// Offsets are from the start of the file. The fields are stored as little-endian integers in the order they're declared.
+struct ShaderArchiveHeader
+{
+    uint32_t Magic;
+    uint32_t EntryCount;
+};
+
+struct ShaderArchiveEntry
+{
+    enum EntryKind : uint32_t { File, ProgramBinary };
+
+    uint64_t DataOffset;
+    uint64_t DataLength;
+    // the program binary cache key of program binaries
+    uint64_t Key;
+    // the name of files
+    uint32_t NameOffset;
+    uint32_t NameLength;
+    uint32_t BinaryFormat;
+    uint32_t Kind;
+};
+
+static const uint32_t kShaderArchiveMagic = 0x52415353; // "SSAR"
+static const size_t kShaderArchiveHeaderSize = 8;
+static const size_t kShaderArchiveEntrySize = 40;
+
+static void WriteArchiveEntry(std::string& out, const ShaderArchiveEntry& entry)
+{
+    WriteLittleEndian(out, entry.DataOffset, 8);
+    WriteLittleEndian(out, entry.DataLength, 8);
+    WriteLittleEndian(out, entry.Key, 8);
+    WriteLittleEndian(out, entry.NameOffset, 4);
+    WriteLittleEndian(out, entry.NameLength, 4);
+    WriteLittleEndian(out, entry.BinaryFormat, 4);
+    WriteLittleEndian(out, entry.Kind, 4);
+}
+
+static ShaderArchiveEntry ReadArchiveEntry(const char* in)
+{
+    ShaderArchiveEntry entry;
+    entry.DataOffset = ReadLittleEndian(in, 8);
+    entry.DataLength = ReadLittleEndian(in + 8, 8);
+    entry.Key = ReadLittleEndian(in + 16, 8);
+    entry.NameOffset = (uint32_t)ReadLittleEndian(in + 24, 4);
+    entry.NameLength = (uint32_t)ReadLittleEndian(in + 28, 4);
+    entry.BinaryFormat = (uint32_t)ReadLittleEndian(in + 32, 4);
+    entry.Kind = (uint32_t)ReadLittleEndian(in + 36, 4);
+    return entry;
+}
+
+struct ShaderSet::Archive
+{
+    struct Entry
+    {
+        const char* Data;
+        size_t Length;
+        GLenum BinaryFormat;
+    };
+
+    // the contents of all files by name, and the program binaries by cache key. They point into the mapped archive.
+    std::unordered_map<std::string, Entry> Files;
+    std::unordered_map<uint64_t, Entry> Programs;
+
+    const char* Data = nullptr;
+    size_t Length = 0;
+#ifdef _WIN32
+    HANDLE Mapping = NULL;
+#endif
+
+    ~Archive()
+    {
+        if (!Data)
+        {
+            return;
+        }
+#ifdef _WIN32
+        UnmapViewOfFile(Data);
+        CloseHandle(Mapping);
+#else
+        munmap((void*)Data, Length);
+#endif
+    }
+
+    bool Map(const char* filename)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        {
+            Mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (Mapping)
+            {
+                Data = (const char*)MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+                if (Data)
+                {
+                    Length = (size_t)size.QuadPart;
+                }
+                else
+                {
+                    CloseHandle(Mapping);
+                    Mapping = NULL;
+                }
+            }
+        }
+        // the mapping keeps the file open
+        CloseHandle(file);
+#else
+        int fd = open(filename, O_RDONLY);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                Data = (const char*)data;
+                Length = (size_t)st.st_size;
+            }
+        }
+        // the mapping keeps the file open
+        close(fd);
+#endif
+        return Data != nullptr;
+    }
+
+    // builds the index of the entries, after validating that they are inside the archive
+    bool Index()
+    {
+        if (Length < kShaderArchiveHeaderSize)
+        {
+            return false;
+        }
+        ShaderArchiveHeader header;
+        header.Magic = (uint32_t)ReadLittleEndian(Data, 4);
+        header.EntryCount = (uint32_t)ReadLittleEndian(Data + 4, 4);
+        if (header.Magic != kShaderArchiveMagic || header.EntryCount > (Length - kShaderArchiveHeaderSize) / kShaderArchiveEntrySize)
+        {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < header.EntryCount; i++)
+        {
+            ShaderArchiveEntry entry = ReadArchiveEntry(Data + kShaderArchiveHeaderSize + i * kShaderArchiveEntrySize);
+            if (entry.DataOffset > Length || entry.DataLength > Length - entry.DataOffset ||
+                entry.NameOffset > Length || entry.NameLength > Length - entry.NameOffset)
+            {
+                return false;
+            }
+
+            Entry indexed = { Data + entry.DataOffset, (size_t)entry.DataLength, entry.BinaryFormat };
+            if (entry.Kind == ShaderArchiveEntry::File)
+            {
+                Files.emplace(std::string(Data + entry.NameOffset, entry.NameLength), indexed);
+            }
+            else if (entry.Kind == ShaderArchiveEntry::ProgramBinary)
+            {
+                Programs.emplace(entry.Key, indexed);
+            }
+        }
+        return true;
+    }
+};
+
+// hash of the GL vendor, renderer and version strings, since program binaries are specific to a driver
+static uint64_t GetDriverHash()
+{
+    uint64_t driverHash = 0;
+    for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+    {
+        const char* str = (const char*)glGetString(name);
+        if (str)
+        {
+            driverHash = HashBytes(str, strlen(str), driverHash);
+        }
+    }
+    return driverHash;
+}
+
+ShaderSet::ShaderSet() = default;
+
+ShaderSet::~ShaderSet()
+{
+    // wait for the workers to be done with the shaders and programs
+    mWorkers.reset();
+
+    for (std::shared_ptr<WorkerJob>& job : mStaleJobs)
+    {
+        glDeleteProgram(job->Program);
+        glDeleteSync(job->Fence);
+    }
+
+    for (ShaderHandle handle : mRemovedShaderHandles)
+    {
+        glDeleteShader(handle);
+    }
+
+    for (const GpuTimer& timer : mPendingGpuTimers)
+    {
+        glDeleteQueries(1, &timer.Query);
+    }
+    if (mGpuTimerActive)
+    {
+        glDeleteQueries(1, &mActiveGpuTimer.Query);
+    }
+    if (!mFreeGpuQueries.empty())
+    {
+        glDeleteQueries((GLsizei)mFreeGpuQueries.size(), mFreeGpuQueries.data());
+    }
+
+    for (Shader& shader : mShaders)
+    {
+        glDeleteShader(shader.Handle);
+    }
+
+    for (Pipeline& pipeline : mPipelines)
+    {
+        glDeleteProgramPipelines(1, &pipeline.PipelineHandle);
+    }
+
+    for (const std::pair<ProgramHandle, uint64_t>& retiredProgram : mRetiredPrograms)
+    {
+        glDeleteProgram(retiredProgram.first);
+    }
+
+    for (Program& program : mPrograms)
+    {
+        glDeleteProgram(program.InternalHandle);
+        if (program.LinkingHandle && program.LinkingHandle != program.InternalHandle)
+        {
+            glDeleteProgram(program.LinkingHandle);
+        }
+        if (program.LinkJob)
+        {
+            glDeleteProgram(program.LinkJob->Program);
+            glDeleteSync(program.LinkJob->Fence);
+        }
+    }
+}
+
+void ShaderSet::SetVersion(const std::string& version)
+{
+    if (version == mVersion)
+    {
+        return;
+    }
+    mVersion = version;
+    mShaderHeaders.clear();
+    MarkAllShadersUpdated();
+}
+
+void ShaderSet::SetPreamble(const std::string& preamble)
+{
+    mPreambleFilename.clear();
+    if (preamble == mPreamble)
+    {
+        return;
+    }
+    mPreamble = preamble;
+    mShaderHeaders.clear();
+    MarkAllShadersUpdated();
+}
+
+void ShaderSet::MarkAllShadersUpdated()
+{
+    for (ShaderID shaderID = 0; shaderID < (ShaderID)mShaders.size(); shaderID++)
+    {
+        // SPIR-V binaries have no header, and the shaders that weren't read yet will be read with the new header anyway
+        const Shader& shader = mShaders[shaderID];
+        if (!shader.Removed && !shader.Spirv && (shader.Timestamp != 0 || mArchive || mFileOverrides.count(shader.Name)))
+        {
+            MarkShaderUpdated(shaderID);
+        }
+    }
+}
+
+void ShaderSet::PollPreambleFile()
+{
+    mPreambleNeedsPoll = false;
+
+    uint64_t fileSize;
+    uint64_t timestamp = GetShaderFileTimestamp(mPreambleFilename.c_str(), fileSize);
+    if (timestamp == 0 || (timestamp == mPreambleTimestamp && fileSize == mPreambleFileSize))
+    {
+        return;
+    }
+    mPreambleTimestamp = timestamp;
+    mPreambleFileSize = fileSize;
+
+    // the preamble goes in every shader, so touching the file without changing it must not recompile everything
+    std::string preamble;
+    ReadSourceFile(mPreambleFilename, preamble);
+    if (preamble != mPreamble)
+    {
+        mPreamble.swap(preamble);
+        mShaderHeaders.clear();
+        MarkAllShadersUpdated();
+    }
+}
+
+GLuint* ShaderSet::AddProgram(const std::vector<std::pair<std::string, GLenum>>& typedShaders, const std::vector<std::string>& defines, const ShaderConstants& constants)
+{
+    // it could never link, and programs are reported and staged by their first shader
+    if (typedShaders.empty())
+    {
+        fprintf(stderr, "AddProgram: a program needs at least one shader\n");
+        return nullptr;
+    }
+
+    std::vector<ShaderID> shaderIDs;
+
+    // sort the defines, so the same set of defines always identifies the same variant
+    std::vector<std::string> sortedDefines = defines;
+    std::sort(sortedDefines.begin(), sortedDefines.end());
+    sortedDefines.erase(std::unique(sortedDefines.begin(), sortedDefines.end()), sortedDefines.end());
+
+    std::string definesSource;
+    for (const std::string& define : sortedDefines)
+    {
+        definesSource += "#define " + define + "\n";
+    }
+
+    // same for the constants, by name (the first value of a name wins)
+    ShaderConstants sortedConstants = constants;
+    std::stable_sort(sortedConstants.begin(), sortedConstants.end(), [](const std::pair<std::string, int32_t>& a, const std::pair<std::string, int32_t>& b)
+    {
+        return a.first < b.first;
+    });
+    sortedConstants.erase(std::unique(sortedConstants.begin(), sortedConstants.end(), [](const std::pair<std::string, int32_t>& a, const std::pair<std::string, int32_t>& b)
+    {
+        return a.first == b.first;
+    }), sortedConstants.end());
+
+    std::string constantsSource;
+    for (const std::pair<std::string, int32_t>& constant : sortedConstants)
+    {
+        constantsSource += "#define " + constant.first + " " + std::to_string(constant.second) + "\n";
+    }
+
+    // find references to existing shaders, and create ones that didn't exist previously.
+    for (const std::pair<std::string, GLenum>& shaderNameType : typedShaders)
+    {
+        ShaderID newShaderID = mFreeShaderIDs.empty() ? (ShaderID)mShaders.size() : mFreeShaderIDs.back();
+        auto foundShader = mShaderIndex.emplace(ShaderVariantKey{ shaderNameType.first, shaderNameType.second, definesSource, constantsSource }, newShaderID);
+        if (foundShader.second)
+        {
+            // test that the file can be opened (to catch typos or missing file bugs)
+            if (mFileOverrides.count(shaderNameType.first))
+            {
+                // read from memory, so the file doesn't have to exist
+            }
+            else if (mArchive)
+            {
+                if (!mArchive->Files.count(shaderNameType.first))
+                {
+                    fprintf(stderr, "Shader %s is not in the shader archive\n", shaderNameType.first.c_str());
+                }
+            }
+            else
+            {
+                std::ifstream ifs(shaderNameType.first);
+                if (!ifs)
+                {
+                    fprintf(stderr, "Failed to open shader %s\n", shaderNameType.first.c_str());
+                }
+            }
+
+            if (newShaderID == (ShaderID)mShaders.size())
+            {
+                mShaders.emplace_back();
+            }
+            else
+            {
+                mFreeShaderIDs.pop_back();
+                mShaders[newShaderID] = Shader();
+            }
+            Shader& shader = mShaders[newShaderID];
+            shader.Name = shaderNameType.first;
+            shader.Type = shaderNameType.second;
+            shader.Handle = glCreateShader(shaderNameType.second);
+            shader.Defines = sortedDefines;
+            shader.DefinesSource = definesSource;
+            shader.Constants = sortedConstants;
+            shader.ConstantsSource = constantsSource;
+            shader.Spirv = EndsWith(shader.Name, ".spv");
+            shader.FileNumber = GetFileNumber(shaderNameType.first);
+
+            mShaderFileIndex[shaderNameType.first].push_back(foundShader.first->second);
+
+            // a variant that only differs by its constants from one that's read already doesn't need to read the file
+            bool sourceCopied = !sortedConstants.empty() && CopyVariantSource(foundShader.first->second);
+
+            // frozen and overridden files are read right away, without checking their timestamp (the file might not exist)
+            if ((mArchive || mFileOverrides.count(shader.Name)) && !sourceCopied)
+            {
+                MarkShaderUpdated(foundShader.first->second);
+            }
+
+            // frozen files are only read once, but overridden ones are still watched in case the override gets cleared
+            if (!mArchive)
+            {
+                if (mFileWatcher)
+                {
+                    WatchShader(foundShader.first->second);
+                }
+                else
+                {
+                    mShadersToPoll.push_back(foundShader.first->second);
+                }
+            }
+        }
+        shaderIDs.push_back(foundShader.first->second);
+    }
+
+    // ensure the programs have a canonical order
+    std::sort(begin(shaderIDs), end(shaderIDs));
+    shaderIDs.erase(std::unique(begin(shaderIDs), end(shaderIDs)), end(shaderIDs));
+
+    if (mSeparablePrograms)
+    {
+        return AddPipeline(shaderIDs);
+    }
+
+    Program& program = mPrograms[FindProgram(shaderIDs, false)];
+    program.RefCount++;
+    return &program.PublicHandle;
+}
+
+// stores a handle with release semantics, since other threads might be reading it (see LoadHandle)
+static void PublishHandle(GLuint* handle, GLuint value)
+{
+#ifdef _MSC_VER
+    _InterlockedExchange((volatile long*)handle, (long)value);
+#else
+    __atomic_store_n(handle, value, __ATOMIC_RELEASE);
+#endif
+}
+
+// publishes the handle of a program or pipeline, to the handle returned by AddProgram() and those returned by AddProgramConcurrent()
+template<class ProgramOrPipeline>
+static void PublishHandles(ProgramOrPipeline& program, GLuint value)
+{
+    PublishHandle(&program.PublicHandle, value);
+    for (GLuint* handle : program.ExtraHandles)
+    {
+        PublishHandle(handle, value);
+    }
+}
+
+GLuint* ShaderSet::AddProgramConcurrent(const std::vector<std::pair<std::string, GLenum>>& typedShaders, const std::vector<std::string>& defines, const ShaderConstants& constants)
+{
+    // rejected right away, since the update that adds the program has no way to report it
+    if (typedShaders.empty())
+    {
+        fprintf(stderr, "AddProgramConcurrent: a program needs at least one shader\n");
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mRegistrationMutex);
+
+    GLuint* handle;
+    if (mFreeHandleSlots.empty())
+    {
+        mHandleSlots.push_back(0);
+        handle = &mHandleSlots.back();
+    }
+    else
+    {
+        handle = mFreeHandleSlots.back();
+        mFreeHandleSlots.pop_back();
+    }
+
+    mPendingPrograms.push_back(PendingProgram{ typedShaders, defines, constants, handle });
+    return handle;
+}
+
+void ShaderSet::AddPendingPrograms()
+{
+    std::vector<PendingProgram> pendingPrograms;
+    {
+        std::lock_guard<std::mutex> lock(mRegistrationMutex);
+        if (mPendingPrograms.empty())
+        {
+            return;
+        }
+        pendingPrograms.swap(mPendingPrograms);
+    }
+
+    // each handle holds the reference taken by AddProgram()
+    for (PendingProgram& pendingProgram : pendingPrograms)
+    {
+        GLuint* program = AddProgram(pendingProgram.TypedShaders, pendingProgram.Defines, pendingProgram.Constants);
+
+        auto foundPipeline = mPipelineHandleIndex.find(program);
+        if (foundPipeline != mPipelineHandleIndex.end())
+        {
+            mPipelines[foundPipeline->second].ExtraHandles.push_back(pendingProgram.Handle);
+            mPipelineHandleIndex.emplace(pendingProgram.Handle, foundPipeline->second);
+        }
+        else
+        {
+            ProgramID programID = mProgramHandleIndex.at(program);
+            mPrograms[programID].ExtraHandles.push_back(pendingProgram.Handle);
+            mProgramHandleIndex.emplace(pendingProgram.Handle, programID);
+        }
+
+        // the program might be linked already
+        PublishHandle(pendingProgram.Handle, *program);
+    }
+}
+
+void ShaderSet::FreeHandleSlot(GLuint* handle)
+{
+    std::lock_guard<std::mutex> lock(mRegistrationMutex);
+    PublishHandle(handle, 0);
+    mFreeHandleSlots.push_back(handle);
+}
+
+ShaderSet::ProgramID ShaderSet::FindProgram(std::vector<ShaderID>& shaderIDs, bool separable)
+{
+    // find the program associated to these shaders (or create it if missing)
+    ProgramID newProgramID = mFreeProgramIDs.empty() ? (ProgramID)mPrograms.size() : mFreeProgramIDs.back();
+    auto foundProgram = mProgramIndex.emplace(shaderIDs, newProgramID);
+    if (foundProgram.second)
+    {
+        ProgramID programID = foundProgram.first->second;
+        if (programID == (ProgramID)mPrograms.size())
+        {
+            mPrograms.emplace_back();
+        }
+        else
+        {
+            // the handle pointer stays the same, since the slot is reused in place.
+            // So does the generation, so the new program can't be mistaken for a version of the old one.
+            mFreeProgramIDs.pop_back();
+            uint32_t generation = mPrograms[programID].Generation;
+            mPrograms[programID] = Program();
+            mPrograms[programID].Generation = generation;
+        }
+        Program& program = mPrograms[programID];
+
+        // public handle is 0 until the program has linked without error
+        program.PublicHandle = 0;
+
+        program.InternalHandle = glCreateProgram();
+        program.Separable = separable;
+        if (separable)
+        {
+            glProgramParameteri(program.InternalHandle, GL_PROGRAM_SEPARABLE, GL_TRUE);
+        }
+        for (ShaderID shaderID : shaderIDs)
+        {
+            // released shaders are attached once they're recreated
+            if (mShaders[shaderID].Handle)
+            {
+                glAttachShader(program.InternalHandle, mShaders[shaderID].Handle);
+            }
+            else
+            {
+                program.ShadersDetached = true;
+            }
+            mShaders[shaderID].Programs.push_back(programID);
+        }
+        program.Shaders = std::move(shaderIDs);
+
+        // link on the next update even if none of its shaders change (they might have been compiled already for another program)
+        program.NeedsLink = true;
+        mProgramsToLink.push_back(programID);
+
+        mProgramHandleIndex.emplace(&program.PublicHandle, programID);
+    }
+
+    return foundProgram.first->second;
+}
+
+// the bit of a shader type for glUseProgramStages
+static GLbitfield GetShaderStageBit(GLenum type)
+{
+    switch (type)
+    {
+    case GL_VERTEX_SHADER:          return GL_VERTEX_SHADER_BIT;
+    case GL_FRAGMENT_SHADER:        return GL_FRAGMENT_SHADER_BIT;
+    case GL_GEOMETRY_SHADER:        return GL_GEOMETRY_SHADER_BIT;
+    case GL_TESS_CONTROL_SHADER:    return GL_TESS_CONTROL_SHADER_BIT;
+    case GL_TESS_EVALUATION_SHADER: return GL_TESS_EVALUATION_SHADER_BIT;
+    case GL_COMPUTE_SHADER:         return GL_COMPUTE_SHADER_BIT;
+    }
+    return 0;
+}
+
+GLuint* ShaderSet::AddPipeline(const std::vector<ShaderID>& shaderIDs)
+{
+    // each shader is linked into its own program, which is shared by all the pipelines using that shader
+    std::vector<ProgramID> stages;
+    for (ShaderID shaderID : shaderIDs)
+    {
+        std::vector<ShaderID> stageShaders(1, shaderID);
+        stages.push_back(FindProgram(stageShaders, true));
+    }
+    std::sort(stages.begin(), stages.end());
+
+    PipelineID newPipelineID = mFreePipelineIDs.empty() ? (PipelineID)mPipelines.size() : mFreePipelineIDs.back();
+    auto foundPipeline = mPipelineIndex.emplace(stages, newPipelineID);
+    if (foundPipeline.second)
+    {
+        PipelineID pipelineID = foundPipeline.first->second;
+        if (pipelineID == (PipelineID)mPipelines.size())
+        {
+            mPipelines.emplace_back();
+        }
+        else
+        {
+            mFreePipelineIDs.pop_back();
+            uint32_t generation = mPipelines[pipelineID].Generation;
+            mPipelines[pipelineID] = Pipeline();
+            mPipelines[pipelineID].Generation = generation;
+        }
+        Pipeline& pipeline = mPipelines[pipelineID];
+
+        // the pipeline holds a reference to each of its stages, until it's removed
+        glGenProgramPipelines(1, &pipeline.PipelineHandle);
+        for (ProgramID programID : stages)
+        {
+            mPrograms[programID].Pipelines.push_back(pipelineID);
+            mPrograms[programID].RefCount++;
+        }
+        pipeline.Stages = std::move(stages);
+
+        mPipelineHandleIndex.emplace(&pipeline.PublicHandle, pipelineID);
+
+        // the stages might all be linked already, if they're shared with other pipelines.
+        // That's not a change of the update (the handle is new to the caller anyway), but its generation still moves on if the slot is reused.
+        if (PublishPipeline(pipeline))
+        {
+            pipeline.Generation++;
+        }
+    }
+
+    Pipeline& pipeline = mPipelines[foundPipeline.first->second];
+    pipeline.RefCount++;
+    return &pipeline.PublicHandle;
+}
+
+template<class T>
+static void EraseValue(std::vector<T>& values, T value)
+{
+    values.erase(std::remove(values.begin(), values.end(), value), values.end());
+}
+
+void ShaderSet::RemoveProgram(const GLuint* program)
+{
+    // the program might have been added concurrently since the last update
+    AddPendingPrograms();
+
+    auto foundPipeline = mPipelineHandleIndex.find(program);
+    if (foundPipeline != mPipelineHandleIndex.end())
+    {
+        PipelineID pipelineID = foundPipeline->second;
+        Pipeline& pipeline = mPipelines[pipelineID];
+        if (program != &pipeline.PublicHandle)
+        {
+            EraseValue(pipeline.ExtraHandles, const_cast<GLuint*>(program));
+            mPipelineHandleIndex.erase(foundPipeline);
+            FreeHandleSlot(const_cast<GLuint*>(program));
+        }
+        if (--pipeline.RefCount > 0)
+        {
+            return;
+        }
+
+        mPipelineHandleIndex.erase(&pipeline.PublicHandle);
+        mPipelineIndex.erase(pipeline.Stages);
+        glDeleteProgramPipelines(1, &pipeline.PipelineHandle);
+        for (ProgramID stageID : pipeline.Stages)
+        {
+            EraseValue(mPrograms[stageID].Pipelines, pipelineID);
+            ReleaseProgram(stageID);
+        }
+
+        uint32_t generation = pipeline.Generation;
+        pipeline = Pipeline();
+        pipeline.Removed = true;
+        pipeline.Generation = generation;
+        mFreePipelineIDs.push_back(pipelineID);
+        return;
+    }
+
+    auto foundProgram = mProgramHandleIndex.find(program);
+    if (foundProgram == mProgramHandleIndex.end() || mPrograms[foundProgram->second].Separable)
+    {
+        fprintf(stderr, "RemoveProgram: the program wasn't returned by this ShaderSet, or was already removed\n");
+        return;
+    }
+
+    ProgramID programID = foundProgram->second;
+    if (program != &mPrograms[programID].PublicHandle)
+    {
+        EraseValue(mPrograms[programID].ExtraHandles, const_cast<GLuint*>(program));
+        mProgramHandleIndex.erase(foundProgram);
+        FreeHandleSlot(const_cast<GLuint*>(program));
+    }
+    ReleaseProgram(programID);
+}
+
+void ShaderSet::ReleaseProgram(ProgramID programID)
+{
+    Program& program = mPrograms[programID];
+    if (--program.RefCount > 0)
+    {
+        return;
+    }
+
+    mProgramHandleIndex.erase(&program.PublicHandle);
+    mProgramIndex.erase(program.Shaders);
+    EraseValue(mProgramsToLink, programID);
+    EraseValue(mLinkingPrograms, programID);
+    EraseValue(mUsedPrograms, programID);
+    for (GpuTimer& timer : mPendingGpuTimers)
+    {
+        // the query still gets read back, but its result is dropped
+        if (timer.Program == programID)
+        {
+            timer.Program = UINT32_MAX;
+        }
+    }
+    if (mGpuTimerActive && mActiveGpuTimer.Program == programID)
+    {
+        mActiveGpuTimer.Program = UINT32_MAX;
+    }
+
+    glDeleteProgram(program.InternalHandle);
+    if (program.LinkingHandle && program.LinkingHandle != program.InternalHandle)
+    {
+        glDeleteProgram(program.LinkingHandle);
+    }
+    if (program.LinkJob)
+    {
+        // the worker might still be linking it
+        mStaleJobs.push_back(std::move(program.LinkJob));
+    }
+
+    std::vector<ShaderID> shaderIDs = std::move(program.Shaders);
+    uint32_t generation = program.Generation;
+    program = Program();
+    program.Removed = true;
+    program.Generation = generation;
+    mFreeProgramIDs.push_back(programID);
+
+    for (ShaderID shaderID : shaderIDs)
+    {
+        Shader& shader = mShaders[shaderID];
+        EraseValue(shader.Programs, programID);
+        if (shader.Programs.empty())
+        {
+            RemoveShader(shaderID);
+        }
+    }
+}
+
+void ShaderSet::RemoveShader(ShaderID shaderID)
+{
+    Shader& shader = mShaders[shaderID];
+
+    mShaderIndex.erase(ShaderVariantKey{ shader.Name, shader.Type, shader.DefinesSource, shader.ConstantsSource });
+    auto foundFile = mShaderFileIndex.find(shader.Name);
+    if (foundFile != mShaderFileIndex.end())
+    {
+        EraseValue(foundFile->second, shaderID);
+        if (foundFile->second.empty())
+        {
+            mShaderFileIndex.erase(foundFile);
+        }
+    }
+    for (IncludeID includeID : shader.Includes)
+    {
+        EraseValue(mIncludeFiles[includeID].Dependents, shaderID);
+        if (mIncludeFiles[includeID].Dependents.empty())
+        {
+            RemoveIncludeFile(includeID);
+        }
+    }
+
+    // stop polling and reading it. The file stays watched, but its changes are ignored.
+    EraseValue(mShadersToPoll, shaderID);
+    EraseValue(mUnwatchedShaders, shaderID);
+    EraseValue(mUpdatedShaders, shaderID);
+    EraseValue(mSettlingShaders, shaderID);
+    EraseValue(mRecentShaders, shaderID);
+    EraseValue(mReadingShaders, shaderID);
+    EraseValue(mCompilingShaders, shaderID);
+
+    // a worker might still be compiling it, or linking it into the (now stale) link of a removed program
+    if (shader.CompileJob)
+    {
+        mStaleJobs.push_back(std::move(shader.CompileJob));
+    }
+    DeleteShaderObject(shader.Handle);
+
+    shader = Shader();
+    shader.Removed = true;
+    mFreeShaderIDs.push_back(shaderID);
+}
+
+void ShaderSet::RemoveIncludeFile(IncludeID includeID)
+{
+    IncludeFile& includeFile = mIncludeFiles[includeID];
+
+    // like shaders, the file stays watched, but its changes are ignored
+    mIncludeIndex.erase(includeFile.Name);
+    EraseValue(mSettlingIncludes, includeID);
+    EraseValue(mRecentIncludes, includeID);
+
+    includeFile = IncludeFile();
+    includeFile.Removed = true;
+    mFreeIncludeIDs.push_back(includeID);
+}
+
+void ShaderSet::DeleteShaderObject(ShaderHandle handle)
+{
+    if (mStaleJobs.empty())
+    {
+        glDeleteShader(handle);
+    }
+    else
+    {
+        mRemovedShaderHandles.push_back(handle);
+    }
+}
+
+static bool IsShaderAttached(GLuint program, GLuint shader)
+{
+    GLint numAttached = 0;
+    glGetProgramiv(program, GL_ATTACHED_SHADERS, &numAttached);
+    if (numAttached <= 0)
+    {
+        return false;
+    }
+    std::vector<GLuint> attached(numAttached);
+    glGetAttachedShaders(program, numAttached, NULL, attached.data());
+    return std::find(attached.begin(), attached.end(), shader) != attached.end();
+}
+
+void ShaderSet::ReleaseShaderObjects(ProgramID programID)
+{
+    for (ShaderID shaderID : mPrograms[programID].Shaders)
+    {
+        Shader& shader = mShaders[shaderID];
+        if (!shader.Handle || shader.Compiling || shader.NeedsCompile || shader.Updated || shader.Settling || shader.ReadJob)
+        {
+            continue;
+        }
+
+        // the other programs using it might still need it to link
+        bool inUse = false;
+        for (ProgramID otherID : shader.Programs)
+        {
+            const Program& other = mPrograms[otherID];
+            if (other.NeedsLink || other.LinkingHandle || other.LinkJob)
+            {
+                inUse = true;
+            }
+        }
+        if (inUse)
+        {
+            continue;
+        }
+
+        for (ProgramID otherID : shader.Programs)
+        {
+            if (IsShaderAttached(mPrograms[otherID].InternalHandle, shader.Handle))
+            {
+                glDetachShader(mPrograms[otherID].InternalHandle, shader.Handle);
+                mPrograms[otherID].ShadersDetached = true;
+            }
+        }
+        DeleteShaderObject(shader.Handle);
+        shader.Handle = 0;
+    }
+}
+
+void ShaderSet::UpdatePipelines(ProgramID programID, bool succeeded)
+{
+    for (PipelineID pipelineID : mPrograms[programID].Pipelines)
+    {
+        Pipeline& pipeline = mPipelines[pipelineID];
+
+        // a stage that failed to link leaves the pipeline unusable, or as it was if the previous version of the stage was kept
+        if (!succeeded)
+        {
+            if (mPrograms[programID].PublicHandle == 0)
+            {
+                PublishHandles(pipeline, 0);
+            }
+            AddPipelineChange(pipeline, false);
+        }
+        // the pipeline only changes once all of its stages are linked
+        else if (PublishPipeline(pipeline))
+        {
+            AddPipelineChange(pipeline, true);
+        }
+    }
+}
+
+bool ShaderSet::PublishPipeline(Pipeline& pipeline)
+{
+    for (ProgramID stageID : pipeline.Stages)
+    {
+        if (mPrograms[stageID].PublicHandle == 0)
+        {
+            PublishHandles(pipeline, 0);
+            return false;
+        }
+    }
+
+    for (ProgramID stageID : pipeline.Stages)
+    {
+        const Program& stage = mPrograms[stageID];
+        glUseProgramStages(pipeline.PipelineHandle, GetShaderStageBit(mShaders[stage.Shaders.front()].Type), stage.PublicHandle);
+    }
+    PublishHandles(pipeline, pipeline.PipelineHandle);
+    return true;
+}
+
+// moves a file to the end of the most recently changed files
+template<class ID>
+static void AddRecentFile(std::vector<ID>& recentFiles, ID id)
+{
+    static const size_t kMaxRecentFiles = 4;
+
+    auto found = std::find(recentFiles.begin(), recentFiles.end(), id);
+    if (found != recentFiles.end())
+    {
+        recentFiles.erase(found);
+    }
+    else if (recentFiles.size() >= kMaxRecentFiles)
+    {
+        recentFiles.erase(recentFiles.begin());
+    }
+    recentFiles.push_back(id);
+}
+
+void ShaderSet::MarkShaderUpdated(ShaderID shaderID)
+{
+    Shader& shader = mShaders[shaderID];
+    if (!shader.Updated)
+    {
+        shader.Updated = true;
+        mUpdatedShaders.push_back(shaderID);
+    }
+}
+
+void ShaderSet::PollShader(ShaderID shaderID)
+{
+    Shader& shader = mShaders[shaderID];
+    if (shader.Removed)
+    {
+        return;
+    }
+
+    uint64_t fileSize;
+    uint64_t timestamp = GetShaderFileTimestamp(shader.Name.c_str(), fileSize);
+    if (timestamp != 0 && (timestamp != shader.Timestamp || fileSize != shader.FileSize))
+    {
+        bool firstLoad = shader.Timestamp == 0;
+        shader.Timestamp = timestamp;
+        shader.FileSize = fileSize;
+        if (!firstLoad)
+        {
+            AddRecentFile(mRecentShaders, shaderID);
+        }
+
+        if (mQuietPeriod == 0 || firstLoad)
+        {
+            MarkShaderUpdated(shaderID);
+            return;
+        }
+
+        // reloaded once the quiet period after the last change is over
+        mLastChangeTime = GetTimeNanoseconds();
+        if (!shader.Settling)
+        {
+            shader.Settling = true;
+            mSettlingShaders.push_back(shaderID);
+        }
+    }
+}
+
+void ShaderSet::PollFiles(uint64_t deadline)
+{
+    auto outOfTime = [deadline]
+    {
+        return deadline != UINT64_MAX && GetTimeNanoseconds() >= deadline;
+    };
+
+    // find all shaders with updated timestamps
+    if (mFileWatcher)
+    {
+        // only poll the shaders whose files were reported as changed
+        mFileWatcher->PollChanges(mChangedFiles);
+        for (const std::string& changedFile : mChangedFiles)
+        {
+            auto foundShaders = mShaderFileIndex.find(changedFile);
+            if (foundShaders != mShaderFileIndex.end())
+            {
+                mShadersToPoll.insert(mShadersToPoll.end(), foundShaders->second.begin(), foundShaders->second.end());
+            }
+
+            auto foundInclude = mIncludeIndex.find(changedFile);
+            if (foundInclude != mIncludeIndex.end())
+            {
+                mIncludeFiles[foundInclude->second].NeedsPoll = true;
+            }
+
+            if (changedFile == mPreambleFilename)
+            {
+                mPreambleNeedsPoll = true;
+            }
+        }
+        mChangedFiles.clear();
+    }
+
+    // the new shaders and those reported as changed, polled even if the time budget is spent so new programs get linked right away
+    for (ShaderID shaderID : mShadersToPoll)
+    {
+        PollShader(shaderID);
+    }
+    mShadersToPoll.clear();
+
+    if (mFileWatcher)
+    {
+        for (ShaderID shaderID : mUnwatchedShaders)
+        {
+            PollShader(shaderID);
+        }
+    }
+    else if (mPollsPerUpdate != 0)
+    {
+        PollSomeFiles();
+    }
+    else if (deadline == UINT64_MAX)
+    {
+        for (ShaderID shaderID = 0; shaderID < (ShaderID)mShaders.size(); shaderID++)
+        {
+            PollShader(shaderID);
+        }
+    }
+    else
+    {
+        // all the shaders then all the included files, continuing from where the previous update ran out of time
+        uint32_t numFiles = (uint32_t)(mShaders.size() + mIncludeFiles.size());
+        for (uint32_t polled = 0; polled < numFiles; polled++)
+        {
+            if (mPollCursor >= numFiles)
+            {
+                mPollCursor = 0;
+            }
+            uint32_t file = mPollCursor++;
+            if (file < (uint32_t)mShaders.size())
+            {
+                PollShader(file);
+            }
+            else
+            {
+                PollInclude(file - (uint32_t)mShaders.size());
+            }
+
+            if (outOfTime())
+            {
+                break;
+            }
+        }
+    }
+
+    if (!mPreambleFilename.empty() && (!mFileWatcher || !mPreambleWatched || mPreambleNeedsPoll))
+    {
+        PollPreambleFile();
+    }
+
+    // re-read the included files that changed (once, no matter how many shaders include them) and update their dependents.
+    // Without a watcher, they were polled along with the shaders if a time budget or a number of polls is set.
+    if (mFileWatcher || (mPollsPerUpdate == 0 && deadline == UINT64_MAX))
+    {
+        for (IncludeID includeID = 0; includeID < (IncludeID)mIncludeFiles.size(); includeID++)
+        {
+            const IncludeFile& includeFile = mIncludeFiles[includeID];
+            if (!mFileWatcher || !includeFile.Watched || includeFile.NeedsPoll)
+            {
+                PollInclude(includeID);
+            }
+        }
+    }
+
+    // reload all the files that changed together, once none of them changed for the quiet period
+    if ((!mSettlingShaders.empty() || !mSettlingIncludes.empty()) && GetTimeNanoseconds() - mLastChangeTime >= mQuietPeriod)
+    {
+        for (IncludeID includeID : mSettlingIncludes)
+        {
+            IncludeFile& includeFile = mIncludeFiles[includeID];
+            includeFile.Settling = false;
+            ReadSourceFile(includeFile.Name, includeFile.Contents);
+            for (ShaderID dependent : includeFile.Dependents)
+            {
+                MarkShaderUpdated(dependent);
+            }
+        }
+        mSettlingIncludes.clear();
+
+        for (ShaderID shaderID : mSettlingShaders)
+        {
+            mShaders[shaderID].Settling = false;
+            MarkShaderUpdated(shaderID);
+        }
+        mSettlingShaders.clear();
+    }
+}
+
+void ShaderSet::PollInclude(IncludeID includeID)
+{
+    if (!mIncludeFiles[includeID].Removed && PollIncludeFile(includeID))
+    {
+        for (ShaderID dependent : mIncludeFiles[includeID].Dependents)
+        {
+            MarkShaderUpdated(dependent);
+        }
+    }
+}
+
+void ShaderSet::PollSomeFiles()
+{
+    for (ShaderID shaderID : mRecentShaders)
+    {
+        PollShader(shaderID);
+    }
+    for (IncludeID includeID : mRecentIncludes)
+    {
+        PollInclude(includeID);
+    }
+
+    // the shaders of the programs in use, which continue from where the previous update stopped if they're too many
+    mUsedShaders.clear();
+    for (ProgramID programID : mUsedPrograms)
+    {
+        mUsedShaders.insert(mUsedShaders.end(), mPrograms[programID].Shaders.begin(), mPrograms[programID].Shaders.end());
+    }
+    mUsedPrograms.clear();
+    std::sort(mUsedShaders.begin(), mUsedShaders.end());
+    mUsedShaders.erase(std::unique(mUsedShaders.begin(), mUsedShaders.end()), mUsedShaders.end());
+
+    uint32_t numPolls = 0;
+    uint32_t maxUsedPolls = std::min(mPollsPerUpdate / 2, (uint32_t)mUsedShaders.size());
+    for (; numPolls < maxUsedPolls; numPolls++)
+    {
+        PollShader(mUsedShaders[mUsedPollCursor++ % mUsedShaders.size()]);
+    }
+
+    // all the shaders then all the included files, in round-robin order
+    uint32_t numFiles = (uint32_t)(mShaders.size() + mIncludeFiles.size());
+    for (uint32_t polled = 0; polled < numFiles && numPolls < mPollsPerUpdate; polled++, numPolls++)
+    {
+        if (mPollCursor >= numFiles)
+        {
+            mPollCursor = 0;
+        }
+        uint32_t file = mPollCursor++;
+        if (file < (uint32_t)mShaders.size())
+        {
+            PollShader(file);
+        }
+        else
+        {
+            PollInclude(file - (uint32_t)mShaders.size());
+        }
+    }
+}
+
+void ShaderSet::SetPollsPerUpdate(uint32_t pollsPerUpdate)
+{
+    mPollsPerUpdate = pollsPerUpdate;
+}
+
+const std::vector<ShaderProgramChange>& ShaderSet::UpdatePrograms()
+{
+    return UpdatePrograms(UINT64_MAX);
+}
+
+const std::vector<ShaderProgramChange>& ShaderSet::UpdatePrograms(uint64_t timeBudget)
+{
+    uint64_t updateStart = GetTimeNanoseconds();
+    ShaderSetEventScope updateScope(mEventSink.get(), "ShaderSet::UpdatePrograms", nullptr);
+
+    mUpdateCount++;
+    mProgramChanges.clear();
+
+    // the program objects replaced long enough ago can't be in use by other threads anymore
+    while (!mRetiredPrograms.empty() && mRetiredPrograms.front().second + mRetireDelay < mUpdateCount)
+    {
+        glDeleteProgram(mRetiredPrograms.front().first);
+        mRetiredPrograms.pop_front();
+    }
+
+    AddPendingPrograms();
+
+    // files received from another machine reload like local edits (and also apply to a frozen set)
+    if (mRemoteSource)
+    {
+        mRemoteSource->PollFiles(mRemoteFiles);
+        for (std::pair<std::string, std::string>& remoteFile : mRemoteFiles)
+        {
+            SetFileOverride(remoteFile.first, remoteFile.second);
+        }
+        mRemoteFiles.clear();
+    }
+
+    uint64_t deadline = timeBudget == UINT64_MAX ? UINT64_MAX : updateStart + timeBudget;
+    auto outOfTime = [deadline]
+    {
+        return deadline != UINT64_MAX && GetTimeNanoseconds() >= deadline;
+    };
+
+    // the files of a frozen set can't change, so only the shaders added since the last update get read
+    if (!mArchive)
+    {
+        PollFiles(deadline);
+    }
+
+    // read the shaders of the most recently used programs first, in case the time budget runs out
+    if (deadline != UINT64_MAX && mUpdatedShaders.size() > 1)
+    {
+        auto lastUsed = [this](ShaderID shaderID)
+        {
+            uint64_t shaderLastUsed = 0;
+            for (ProgramID programID : mShaders[shaderID].Programs)
+            {
+                shaderLastUsed = std::max(shaderLastUsed, mPrograms[programID].LastUsed);
+            }
+            return shaderLastUsed;
+        };
+        std::stable_sort(mUpdatedShaders.begin(), mUpdatedShaders.end(), [&lastUsed](ShaderID a, ShaderID b)
+        {
+            return lastUsed(a) > lastUsed(b);
+        });
+    }
+
+    // reload the source of all updated shaders. They get recompiled once a program that uses them needs to be relinked
+    // (which a cached program binary might make unnecessary).
+    size_t numShadersRead = 0;
+    for (ShaderID shaderID : mUpdatedShaders)
+    {
+        // the remaining shaders are read by the next updates
+        if (numShadersRead > 0 && outOfTime())
+        {
+            break;
+        }
+        numShadersRead++;
+
+        Shader& shader = mShaders[shaderID];
+        shader.Updated = false;
+
+        if (mWorkers && !mArchive && !mFileOverrides.count(shader.Name))
+        {
+            // read the file on a worker, and pick up the contents on a later update.
+            // If a read was already in flight, it's out of date and its result gets ignored.
+            if (!shader.ReadJob)
+            {
+                mReadingShaders.push_back(shaderID);
+            }
+            shader.ReadJob = std::make_shared<WorkerJob>();
+            shader.ReadJob->Type = WorkerJob::ReadFile;
+            shader.ReadJob->Filename = shader.Name;
+            mWorkers->Submit(shader.ReadJob);
+            continue;
+        }
+
+        {
+            ShaderSetEventScope readScope(mEventSink.get(), "ShaderSet::ReadFile", shader.Name.c_str());
+            uint64_t readStart = GetTimeNanoseconds();
+            ReadSourceFile(shader.Name, mReadBuffer);
+            shader.ReadTime = GetTimeNanoseconds() - readStart;
+        }
+
+        if (ReadShaderSource(shaderID, mReadBuffer))
+        {
+            MarkProgramsToLink(shaderID);
+        }
+        // otherwise the file was touched without changing its contents, so there's nothing to recompile or relink
+    }
+    mUpdatedShaders.erase(mUpdatedShaders.begin(), mUpdatedShaders.begin() + numShadersRead);
+
+    // pick up the files read by worker threads
+    for (auto it = mReadingShaders.begin(); it != mReadingShaders.end(); )
+    {
+        Shader& shader = mShaders[*it];
+        if (!shader.ReadJob->Done.load(std::memory_order_acquire))
+        {
+            ++it;
+            continue;
+        }
+
+        std::shared_ptr<WorkerJob> job = std::move(shader.ReadJob);
+        shader.ReadTime = job->Duration;
+        if (ReadShaderSource(*it, job->Contents))
+        {
+            MarkProgramsToLink(*it);
+        }
+        it = mReadingShaders.erase(it);
+    }
+
+    // clean up the links that were out of date before they finished, and the compiles of removed shaders
+    for (auto it = mStaleJobs.begin(); it != mStaleJobs.end(); )
+    {
+        if ((*it)->Done.load(std::memory_order_acquire))
+        {
+            glDeleteProgram((*it)->Program);
+            glDeleteSync((*it)->Fence);
+            it = mStaleJobs.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    if (mStaleJobs.empty())
+    {
+        for (ShaderHandle handle : mRemovedShaderHandles)
+        {
+            glDeleteShader(handle);
+        }
+        mRemovedShaderHandles.clear();
+    }
+
+    // relink the most recently used programs first, in case the time budget runs out
+    if (deadline != UINT64_MAX)
+    {
+        std::stable_sort(mProgramsToLink.begin(), mProgramsToLink.end(), [this](ProgramID a, ProgramID b)
+        {
+            return mPrograms[a].LastUsed > mPrograms[b].LastUsed;
+        });
+    }
+
+    // issue the compiles needed by the programs to relink, all before any link so they can overlap when compiling asynchronously
+    bool compilesIssued = false;
+    // (by index, since re-reading a released shader can append the programs it's part of to the list)
+    for (size_t i = 0; i < mProgramsToLink.size(); )
+    {
+        ProgramID programID = mProgramsToLink[i];
+        Program& program = mPrograms[programID];
+
+        if (!program.CompilesIssued)
+        {
+            // the compiles of the remaining programs are issued by the next updates
+            if (compilesIssued && outOfTime())
+            {
+                break;
+            }
+            compilesIssued = true;
+
+            // skip compiling and linking entirely if the program binary is cached
+            bool hasCachedBinaries = !mProgramBinaryCacheDirectory.empty() || (mArchive && !mArchive->Programs.empty());
+            if (hasCachedBinaries && LoadCachedProgram(programID))
+            {
+                program.NeedsLink = false;
+                if (mReleaseShaderObjects)
+                {
+                    ReleaseShaderObjects(programID);
+                }
+                mProgramsToLink.erase(mProgramsToLink.begin() + i);
+                continue;
+            }
+
+            // compile the shaders that changed since they were last compiled
+            // (except those already being compiled on a worker thread, since a shader can't be compiled by two threads at once.)
+            for (ShaderID shaderID : program.Shaders)
+            {
+                Shader& shader = mShaders[shaderID];
+                if (!shader.Handle && !shader.NeedsCompile && !shader.Updated && !shader.ReadJob)
+                {
+                    // the shader object was released, so its source has to be read again to recompile it
+                    ReadSourceFile(shader.Name, mReadBuffer);
+                    if (ReadShaderSource(shaderID, mReadBuffer))
+                    {
+                        MarkProgramsToLink(shaderID);
+                    }
+                }
+                if (shader.NeedsCompile && !shader.CompileJob)
+                {
+                    CompileShader(shaderID);
+                }
+            }
+            program.CompilesIssued = true;
+        }
+
+        i++;
+    }
+
+    // collect the compile results of the shaders that finished compiling in the background
+    for (auto it = mCompilingShaders.begin(); it != mCompilingShaders.end(); )
+    {
+        GLint completed;
+        if (mShaders[*it].CompileJob)
+        {
+            completed = mShaders[*it].CompileJob->Done.load(std::memory_order_acquire);
+        }
+        else
+        {
+            glGetShaderiv(mShaders[*it].Handle, GL_COMPLETION_STATUS_KHR, &completed);
+        }
+        if (completed)
+        {
+            FinishCompile(*it);
+            it = mCompilingShaders.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    // relink all programs that had their shaders updated and have all their shaders compiling successfully
+    bool linked = false;
+    for (auto it = mProgramsToLink.begin(); it != mProgramsToLink.end(); )
+    {
+        Program& program = mPrograms[*it];
+
+        // the remaining programs are linked by the next updates
+        if (linked && outOfTime())
+        {
+            break;
+        }
+
+        // its compiles weren't issued yet because the time budget ran out (or they're out of date)
+        if (!program.CompilesIssued)
+        {
+            ++it;
+            continue;
+        }
+
+        // Wait for the shaders still compiling in the background, and don't attempt to link shaders that didn't compile successfully
+        bool shadersCompiling = false;
+        bool canRelink = true;
+        for (ShaderID shaderID : program.Shaders)
+        {
+            const Shader& shader = mShaders[shaderID];
+            if (shader.Compiling || shader.Updated || shader.ReadJob)
+            {
+                // also wait for the files that changed but weren't read yet, rather than linking an outdated version
+                shadersCompiling = true;
+                break;
+            }
+            if (shader.NeedsCompile)
+            {
+                // its compile was put off until a compile in flight on a worker finished
+                program.CompilesIssued = false;
+                shadersCompiling = true;
+                break;
+            }
+            if (!shader.CompileStatus)
+            {
+                canRelink = false;
+            }
+        }
+
+        if (shadersCompiling)
+        {
+            ++it;
+            continue;
+        }
+
+        program.NeedsLink = false;
+        program.CompilesIssued = false;
+        if (canRelink)
+        {
+            LinkProgram(*it);
+            linked = true;
+        }
+        it = mProgramsToLink.erase(it);
+    }
+
+    // publish the programs that finished linking in the background
+    for (auto it = mLinkingPrograms.begin(); it != mLinkingPrograms.end(); )
+    {
+        GLint completed;
+        if (mPrograms[*it].LinkJob)
+        {
+            completed = mPrograms[*it].LinkJob->Done.load(std::memory_order_acquire) && IsWorkerLinkDone(mPrograms[*it].LinkJob->Fence);
+        }
+        else
+        {
+            glGetProgramiv(mPrograms[*it].LinkingHandle, GL_COMPLETION_STATUS_KHR, &completed);
+        }
+        if (completed)
+        {
+            FinishLink(*it);
+            it = mLinkingPrograms.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    if (!mPendingGpuTimers.empty())
+    {
+        ReadGpuTimers();
+    }
+
+    mUpdateTime = GetTimeNanoseconds() - updateStart;
+    return mProgramChanges;
+}
+
+template<class ProgramOrPipeline>
+void ShaderSet::AddProgramChange(ProgramOrPipeline& program, bool succeeded)
+{
+    program.Generation++;
+    mProgramChanges.push_back(ShaderProgramChange{ &program.PublicHandle, program.Generation, succeeded });
+    for (const GLuint* handle : program.ExtraHandles)
+    {
+        mProgramChanges.push_back(ShaderProgramChange{ handle, program.Generation, succeeded });
+    }
+}
+
+void ShaderSet::AddPipelineChange(Pipeline& pipeline, bool succeeded)
+{
+    // a pipeline is reported once per update even if several of its stages changed, as failed if any of them failed
+    if (pipeline.ChangeUpdate == mUpdateCount)
+    {
+        for (size_t i = pipeline.ChangeIndex; i < pipeline.ChangeIndex + 1 + pipeline.ExtraHandles.size(); i++)
+        {
+            mProgramChanges[i].Succeeded = mProgramChanges[i].Succeeded && succeeded;
+        }
+        return;
+    }
+
+    pipeline.ChangeUpdate = mUpdateCount;
+    pipeline.ChangeIndex = mProgramChanges.size();
+    AddProgramChange(pipeline, succeeded);
+}
+
+void ShaderSet::MarkProgramsToLink(ShaderID shaderID)
+{
+    for (ProgramID programID : mShaders[shaderID].Programs)
+    {
+        Program& program = mPrograms[programID];
+
+        // if the program was already waiting on compiles, they're out of date now
+        program.CompilesIssued = false;
+        if (!program.NeedsLink)
+        {
+            program.NeedsLink = true;
+            mProgramsToLink.push_back(programID);
+        }
+    }
+}
+
+const ShaderSet::ShaderHeader& ShaderSet::GetShaderHeader(GLenum type)
+{
+    auto foundHeader = mShaderHeaders.find(type);
+    if (foundHeader != mShaderHeaders.end())
+    {
+        return foundHeader->second;
+    }
+
+    std::string header = "#version " + mVersion + "\n";
+
+    switch (type) {
+    case GL_VERTEX_SHADER:          header += "#define VERTEX_SHADER\n";             break;
+    case GL_FRAGMENT_SHADER:        header += "#define FRAGMENT_SHADER\n";           break;
+    case GL_GEOMETRY_SHADER:        header += "#define GEOMETRY_SHADER\n";           break;
+    case GL_TESS_CONTROL_SHADER:    header += "#define TESS_CONTROL_SHADER\n";       break;
+    case GL_TESS_EVALUATION_SHADER: header += "#define TESS_EVALUATION_SHADER\n";    break;
+    case GL_COMPUTE_SHADER:         header += "#define COMPUTE_SHADER\n";            break;
+    }
+
+    header += "#line 1 " + std::to_string(GetFileNumber("")) + "\n" +
+              mPreamble + "\n";
+
+    ShaderHeader& shaderHeader = mShaderHeaders[type];
+    shaderHeader.Hash = HashBytes(header.data(), header.size(), 0);
+    shaderHeader.Text = std::make_shared<const std::string>(std::move(header));
+    return shaderHeader;
+}
+
+bool ShaderSet::ReadShaderSource(ShaderID shaderID, std::string& contents)
+{
+    Shader& shader = mShaders[shaderID];
+
+    if (shader.Spirv)
+    {
+        // binaries are loaded as-is, without header, defines, or includes
+        shader.ReloadCount++;
+        shader.SourceSize = contents.size();
+        if (mEventSink)
+        {
+            mEventSink->ShaderRead(GetShaderStats(shaderID));
+        }
+
+        uint64_t baseHash = HashBytes(contents.data(), contents.size(), 0);
+        uint64_t binaryHash = HashConstants(shader.ConstantsSource, baseHash);
+        bool binaryUnchanged = shader.SourceHash != 0 && binaryHash == shader.SourceHash;
+        if (mContentHashing && binaryUnchanged && shader.Handle)
+        {
+            return false;
+        }
+
+        shader.Source.swap(contents);
+        shader.SourceHash = binaryHash;
+        shader.BaseSourceHash = baseHash;
+        shader.NeedsCompile = true;
+        return !(binaryUnchanged && !shader.Handle);
+    }
+
+    const ShaderHeader& header = GetShaderHeader(shader.Type);
+
+    // the source is the contents themselves, unless includes need to be spliced into it.
+    // The word "include" is searched first, so files without any #include are never copied.
+    std::string source;
+    if (mIncludeSupport && contents.find("include") != std::string::npos)
+    {
+        std::vector<IncludeID> includes;
+        source.reserve(contents.size());
+        AppendIncludedSource(source, shader.Name, contents, shader.FileNumber, includes);
+        SetShaderIncludes(shaderID, includes);
+    }
+    else
+    {
+        if (mIncludeSupport)
+        {
+            std::vector<IncludeID> noIncludes;
+            SetShaderIncludes(shaderID, noIncludes);
+        }
+        source.swap(contents);
+    }
+
+    shader.ReloadCount++;
+    shader.SourceSize = source.size();
+    if (mEventSink)
+    {
+        mEventSink->ShaderRead(GetShaderStats(shaderID));
+    }
+
+    // hashes the same bytes as glShaderSource gets (see SetShaderSource), with the constants last so the variants share the hash of the rest
+    uint64_t baseHash = HashBytes(shader.DefinesSource.data(), shader.DefinesSource.size(), header.Hash);
+    baseHash = HashBytes(&shader.FileNumber, sizeof(shader.FileNumber), baseHash);
+    baseHash = HashBytes(source.data(), source.size(), baseHash);
+    uint64_t sourceHash = HashConstants(shader.ConstantsSource, baseHash);
+
+    // a hash of 0 means the source was never read before
+    bool unchanged = shader.SourceHash != 0 && sourceHash == shader.SourceHash;
+    if (mContentHashing && unchanged && shader.Handle)
+    {
+        return false;
+    }
+
+    // kept until the shader gets compiled
+    shader.Source.swap(source);
+    shader.SourceHeader = header.Text;
+    shader.SourceHash = sourceHash;
+    shader.BaseSourceHash = baseHash;
+    shader.NeedsCompile = true;
+
+    // a released shader that is read again only to be recompiled doesn't need the other programs using it to relink
+    return !(unchanged && !shader.Handle);
+}
+
+bool ShaderSet::CopyVariantSource(ShaderID shaderID)
+{
+    Shader& shader = mShaders[shaderID];
+    for (ShaderID variantID : mShaderFileIndex[shader.Name])
+    {
+        // only shaders with constants keep their source, and it's only up-to-date if the file isn't about to be read again
+        const Shader& variant = mShaders[variantID];
+        if (variantID == shaderID || variant.Removed || variant.Constants.empty() || variant.Type != shader.Type || variant.DefinesSource != shader.DefinesSource ||
+            variant.SourceHash == 0 || variant.Updated || variant.Settling || variant.ReadJob)
+        {
+            continue;
+        }
+
+        shader.Source = variant.Source;
+        shader.SourceSize = variant.SourceSize;
+        shader.Timestamp = variant.Timestamp;
+        shader.FileSize = variant.FileSize;
+        shader.BaseSourceHash = variant.BaseSourceHash;
+        shader.SourceHash = HashConstants(shader.ConstantsSource, variant.BaseSourceHash);
+        if (!shader.Spirv)
+        {
+            shader.SourceHeader = GetShaderHeader(shader.Type).Text;
+        }
+        if (mIncludeSupport)
+        {
+            std::vector<IncludeID> includes = variant.Includes;
+            SetShaderIncludes(shaderID, includes);
+        }
+        shader.NeedsCompile = true;
+        return true;
+    }
+    return false;
+}
+
+int32_t ShaderSet::GetFileNumber(const std::string& filename)
+{
+    // Limited to 15 bits because some implementations are limited to 16 bits, and the sign bit is left out,
+    // since some shader compilers treat the #line as signed, and others treat it unsigned.
+    const size_t kNumFileNumbers = 0x8000;
+
+    auto foundNumber = mFileNumbers.emplace(filename, 0);
+    if (!foundNumber.second)
+    {
+        return foundNumber.first->second;
+    }
+
+    // The number comes from the hash of the name, so it's the same from run to run (like the sources hashed for the program binary cache),
+    // and the next free number is taken when another name has it. Only past 32768 files do names have to share numbers.
+    if (mFileNumberNames.empty())
+    {
+        mFileNumberNames.resize(kNumFileNumbers);
+    }
+    size_t number = std::hash<std::string>()(filename) & (kNumFileNumbers - 1);
+    for (size_t probe = 0; probe < kNumFileNumbers && mFileNumberNames[number]; probe++)
+    {
+        number = (number + 1) & (kNumFileNumbers - 1);
+    }
+    if (!mFileNumberNames[number])
+    {
+        mFileNumberNames[number] = &foundNumber.first->first;
+    }
+
+    foundNumber.first->second = (int32_t)number;
+    return foundNumber.first->second;
+}
+
+// skips a word at the start of a message (case-insensitive), and returns true if it was there
+static bool SkipLogWord(const char*& p, const char* end, const char* word)
+{
+    const char* q = p;
+    for (; *word; word++, q++)
+    {
+        if (q == end || tolower((unsigned char)*q) != *word)
+        {
+            return false;
+        }
+    }
+    p = q;
+    return true;
+}
+
+static bool ParseLogSeverity(const char*& p, const char* end, ShaderDiagnostic::SeverityType& severity)
+{
+    if (SkipLogWord(p, end, "error"))
+    {
+        severity = ShaderDiagnostic::Error;
+    }
+    else if (SkipLogWord(p, end, "warning"))
+    {
+        severity = ShaderDiagnostic::Warning;
+    }
+    else if (SkipLogWord(p, end, "info") || SkipLogWord(p, end, "note"))
+    {
+        severity = ShaderDiagnostic::Info;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+static bool ParseLogNumber(const char*& p, const char* end, uint32_t& number)
+{
+    if (p == end || !isdigit((unsigned char)*p))
+    {
+        return false;
+    }
+    number = 0;
+    for (; p < end && isdigit((unsigned char)*p); p++)
+    {
+        number = number * 10 + (*p - '0');
+    }
+    return true;
+}
+
+std::string ShaderSet::ResolveLog(const std::string& log)
+{
+    std::string resolved;
+    resolved.reserve(log.size());
+
+    ShaderDiagnostic diagnostic;
+    for (const char* line = log.data(), *end = log.data() + log.size(); line < end; )
+    {
+        const char* lineEnd = std::find(line, end, '\n');
+        const char* next = lineEnd == end ? end : lineEnd + 1;
+
+        // The logs of the drivers and translators put the location of the message in one of these forms:
+        //     ERROR: 0:12: message (glslang, AMD, Intel)
+        //     0(12) : error C0000: message (NVIDIA)
+        //     0:12(5): error: message (Mesa)
+        // where the first number is the file number of the #line directives.
+        const char* p = line;
+        bool hasSeverity = ParseLogSeverity(p, lineEnd, diagnostic.Severity) && p < lineEnd && *p == ':';
+        if (hasSeverity)
+        {
+            p++;
+            while (p < lineEnd && *p == ' ')
+                p++;
+        }
+        else
+        {
+            p = line;
+            diagnostic.Severity = ShaderDiagnostic::Info;
+        }
+
+        const char* fileStart = p;
+        uint32_t fileNumber = 0;
+        uint32_t lineNumber = 0;
+        bool located = false;
+        if (ParseLogNumber(p, lineEnd, fileNumber) && p < lineEnd)
+        {
+            const char* fileEnd = p;
+            if (*p == ':')
+            {
+                p++;
+                located = ParseLogNumber(p, lineEnd, lineNumber);
+            }
+            else if (*p == '(')
+            {
+                p++;
+                located = ParseLogNumber(p, lineEnd, lineNumber) && p < lineEnd && *p == ')';
+                p++;
+            }
+
+            if (located)
+            {
+                // the column, if any
+                if (p < lineEnd && *p == '(')
+                {
+                    const char* q = p + 1;
+                    uint32_t column;
+                    if (ParseLogNumber(q, lineEnd, column) && q < lineEnd && *q == ')')
+                    {
+                        p = q + 1;
+                    }
+                }
+
+                const std::string* name = fileNumber < mFileNumberNames.size() ? mFileNumberNames[fileNumber] : nullptr;
+                if (!name)
+                {
+                    diagnostic.File.assign(fileStart, fileEnd);
+                }
+                else if (name->empty())
+                {
+                    diagnostic.File = mPreambleFilename.empty() ? "preamble" : mPreambleFilename;
+                }
+                else
+                {
+                    diagnostic.File = *name;
+                }
+
+                resolved.append(line, fileStart);
+                resolved += diagnostic.File;
+                resolved.append(fileEnd, next);
+            }
+        }
+        if (!located)
+        {
+            p = hasSeverity ? fileStart : line;
+            diagnostic.File.clear();
+            lineNumber = 0;
+            resolved.append(line, next);
+        }
+
+        // the severity and code after the location (eg. ": error C0000:")
+        while (p < lineEnd && (*p == ' ' || *p == ':'))
+            p++;
+        const char* messageStart = p;
+        if (!hasSeverity && ParseLogSeverity(p, lineEnd, diagnostic.Severity))
+        {
+            while (p < lineEnd && (isalnum((unsigned char)*p) || *p == ' ' || *p == '(' || *p == ')' || *p == '#'))
+                p++;
+            if (p < lineEnd && *p == ':')
+            {
+                p++;
+            }
+            else
+            {
+                // not followed by a code, so it's part of the message (eg. "error linking")
+                p = messageStart;
+                diagnostic.Severity = ShaderDiagnostic::Info;
+            }
+        }
+        while (p < lineEnd && *p == ' ')
+            p++;
+        const char* messageEnd = lineEnd;
+        while (messageEnd > p && (messageEnd[-1] == '\r' || messageEnd[-1] == ' '))
+            messageEnd--;
+
+        if (mDiagnosticCallback && (located || messageEnd > p))
+        {
+            diagnostic.Line = lineNumber;
+            diagnostic.Message.assign(p, messageEnd);
+            mDiagnosticCallback(diagnostic);
+        }
+
+        line = next;
+    }
+
+    return resolved;
+}
+
+void ShaderSet::SetDiagnosticCallback(ShaderDiagnosticCallback callback)
+{
+    mDiagnosticCallback = std::move(callback);
+}
+
+// if the line is an #include "file" directive, returns true and the included file name
+static bool ParseIncludeDirective(const char* line, const char* lineEnd, std::string& includeName)
+{
+    const char* p = line;
+    auto skipSpaces = [&p, lineEnd]
+    {
+        while (p < lineEnd && (*p == ' ' || *p == '\t'))
+            p++;
+    };
+
+    skipSpaces();
+    if (p == lineEnd || *p != '#')
+        return false;
+    p++;
+
+    skipSpaces();
+    if ((size_t)(lineEnd - p) < 7 || strncmp(p, "include", 7) != 0)
+        return false;
+    p += 7;
+
+    skipSpaces();
+    if (p == lineEnd || *p != '"')
+        return false;
+    p++;
+
+    const char* nameEnd = std::find(p, lineEnd, '"');
+    if (nameEnd == lineEnd || nameEnd == p)
+        return false;
+
+    includeName.assign(p, nameEnd);
+    return true;
+}
+
+void ShaderSet::AppendIncludedSource(std::string& source, const std::string& filename, const std::string& contents, int32_t fileNumber,
+                                     std::vector<IncludeID>& includes)
+{
+    std::string directory, unused;
+    SplitPath(filename, directory, unused);
+
+    std::string includeName;
+    int lineNumber = 1;
+    for (const char* line = contents.data(), *end = contents.data() + contents.size(); line < end; lineNumber++)
+    {
+        const char* lineEnd = std::find(line, end, '\n');
+        const char* next = lineEnd == end ? end : lineEnd + 1;
+
+        if (!ParseIncludeDirective(line, lineEnd, includeName))
+        {
+            source.append(line, next);
+            line = next;
+            continue;
+        }
+        line = next;
+
+        // includes are relative to the directory of the file that includes them
+        bool absolute = includeName[0] == '/' || includeName[0] == '\\' || (includeName.size() > 1 && includeName[1] == ':');
+        std::string includePath = (absolute || directory == ".") ? includeName : directory + "/" + includeName;
+
+        IncludeID includeID = FindIncludeFile(includePath);
+        if (std::find(includes.begin(), includes.end(), includeID) != includes.end())
+        {
+            // already included, but keep the line so the line numbers stay right
+            source += "\n";
+            continue;
+        }
+        includes.push_back(includeID);
+
+        const IncludeFile& includeFile = mIncludeFiles[includeID];
+        source += "#line 1 " + std::to_string(includeFile.FileNumber) + "\n";
+        AppendIncludedSource(source, includeFile.Name, includeFile.Contents, includeFile.FileNumber, includes);
+        source += "\n#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileNumber) + "\n";
+    }
+}
+
+ShaderSet::IncludeID ShaderSet::FindIncludeFile(const std::string& filename)
+{
+    IncludeID newIncludeID = mFreeIncludeIDs.empty() ? (IncludeID)mIncludeFiles.size() : mFreeIncludeIDs.back();
+    auto foundInclude = mIncludeIndex.emplace(filename, newIncludeID);
+    if (!foundInclude.second)
+    {
+        return foundInclude.first->second;
+    }
+
+    if (newIncludeID == (IncludeID)mIncludeFiles.size())
+    {
+        mIncludeFiles.emplace_back();
+    }
+    else
+    {
+        mFreeIncludeIDs.pop_back();
+        mIncludeFiles[newIncludeID] = IncludeFile();
+    }
+    IncludeFile& includeFile = mIncludeFiles[newIncludeID];
+    includeFile.Name = filename;
+    includeFile.FileNumber = GetFileNumber(filename);
+    includeFile.Watched = mFileWatcher && mFileWatcher->Watch(filename);
+
+    if (mArchive || mFileOverrides.count(filename))
+    {
+        ReadSourceFile(filename, includeFile.Contents);
+    }
+    else if (!PollIncludeFile(foundInclude.first->second))
+    {
+        fprintf(stderr, "Failed to open included file %s\n", filename.c_str());
+    }
+
+    return foundInclude.first->second;
+}
+
+bool ShaderSet::PollIncludeFile(IncludeID includeID)
+{
+    IncludeFile& includeFile = mIncludeFiles[includeID];
+    includeFile.NeedsPoll = false;
+
+    uint64_t fileSize;
+    uint64_t timestamp = GetShaderFileTimestamp(includeFile.Name.c_str(), fileSize);
+    if (timestamp == 0 || (timestamp == includeFile.Timestamp && fileSize == includeFile.FileSize))
+    {
+        return false;
+    }
+
+    bool firstLoad = includeFile.Timestamp == 0;
+    includeFile.Timestamp = timestamp;
+    includeFile.FileSize = fileSize;
+    if (!firstLoad)
+    {
+        AddRecentFile(mRecentIncludes, includeID);
+    }
+
+    if (mQuietPeriod != 0 && !firstLoad)
+    {
+        // re-read once the quiet period after the last change is over
+        mLastChangeTime = GetTimeNanoseconds();
+        if (!includeFile.Settling)
+        {
+            includeFile.Settling = true;
+            mSettlingIncludes.push_back(includeID);
+        }
+        return false;
+    }
+
+    ReadSourceFile(includeFile.Name, includeFile.Contents);
+    return true;
+}
+
+void ShaderSet::SetShaderIncludes(ShaderID shaderID, std::vector<IncludeID>& includes)
+{
+    Shader& shader = mShaders[shaderID];
+
+    for (IncludeID includeID : shader.Includes)
+    {
+        std::vector<ShaderID>& dependents = mIncludeFiles[includeID].Dependents;
+        dependents.erase(std::remove(dependents.begin(), dependents.end(), shaderID), dependents.end());
+    }
+
+    for (IncludeID includeID : includes)
+    {
+        mIncludeFiles[includeID].Dependents.push_back(shaderID);
+    }
+
+    // the files the shader doesn't include anymore might not be included by any other shader
+    for (IncludeID includeID : shader.Includes)
+    {
+        if (mIncludeFiles[includeID].Dependents.empty())
+        {
+            RemoveIncludeFile(includeID);
+        }
+    }
+
+    shader.Includes.swap(includes);
+}
+
+void ShaderSet::CompileShader(ShaderID shaderID)
+{
+    Shader& shader = mShaders[shaderID];
+    shader.NeedsCompile = false;
+    shader.CompileStart = GetTimeNanoseconds();
+
+    if (!shader.Handle)
+    {
+        shader.Handle = glCreateShader(shader.Type);
+    }
+
+    if (mWorkers)
+    {
+        shader.CompileJob = std::make_shared<WorkerJob>();
+        shader.CompileJob->Type = WorkerJob::Compile;
+        shader.CompileJob->Shader = shader.Handle;
+        shader.CompileJob->SourceHeader = std::move(shader.SourceHeader);
+        shader.CompileJob->Defines = shader.DefinesSource;
+        shader.CompileJob->Constants = shader.Constants;
+        shader.CompileJob->ConstantsSource = shader.ConstantsSource;
+        shader.CompileJob->FileNumber = shader.FileNumber;
+        if (shader.Constants.empty())
+        {
+            shader.CompileJob->Source = std::move(shader.Source);
+        }
+        else
+        {
+            shader.CompileJob->Source = shader.Source;
+        }
+        shader.CompileJob->ShaderType = shader.Type;
+        shader.CompileJob->Spirv = shader.Spirv;
+        if (!shader.Spirv && mSpirvCompiler)
+        {
+            shader.CompileJob->SpirvCompiler = mSpirvCompiler;
+            shader.CompileJob->SpirvCacheFilename = SpirvCacheFilename(shader.BaseSourceHash);
+        }
+        mWorkers->Submit(shader.CompileJob);
+
+        shader.Compiling = true;
+        mCompilingShaders.push_back(shaderID);
+        return;
+    }
+
+    ShaderSetEventScope compileScope(mEventSink.get(), "ShaderSet::Compile", shader.Name.c_str());
+
+    if (shader.Spirv)
+    {
+        SetShaderSpirv(shader.Handle, shader.Source.data(), shader.Source.size(), shader.Constants);
+    }
+    else if (mSpirvCompiler)
+    {
+        std::string log;
+        if (!TranslateShaderToSpirv(shader.Handle, shader.Type, mSpirvCompiler, SpirvCacheFilename(shader.BaseSourceHash),
+                                    *shader.SourceHeader, shader.DefinesSource, shader.FileNumber, shader.Source, shader.Constants, log))
+        {
+            if (shader.Constants.empty())
+            {
+                RecycleShaderSource(shader);
+            }
+            shader.SourceHeader.reset();
+            FinishCompile(shaderID, &log);
+            return;
+        }
+    }
+    else
+    {
+        SetShaderSource(shader.Handle, *shader.SourceHeader, shader.DefinesSource, shader.ConstantsSource, shader.FileNumber, shader.Source);
+        glCompileShader(shader.Handle);
+    }
+
+    if (shader.Constants.empty())
+    {
+        RecycleShaderSource(shader);
+    }
+    shader.SourceHeader.reset();
+
+    if (mAsyncCompilation)
+    {
+        // the result is collected by a later update, once the compiler is done with it
+        if (!shader.Compiling)
+        {
+            shader.Compiling = true;
+            mCompilingShaders.push_back(shaderID);
+        }
+    }
+    else
+    {
+        FinishCompile(shaderID);
+    }
+}
+
+void ShaderSet::FinishCompile(ShaderID shaderID, const std::string* translationLog)
+{
+    Shader& shader = mShaders[shaderID];
+    shader.Compiling = false;
+
+    GLint status;
+    std::string log_s;
+    if (translationLog)
+    {
+        status = 0;
+        log_s = *translationLog;
+        shader.CompileTime = GetTimeNanoseconds() - shader.CompileStart;
+    }
+    else if (shader.CompileJob)
+    {
+        shader.CompileTime = shader.CompileJob->Duration;
+        status = shader.CompileJob->Status;
+        log_s = std::move(shader.CompileJob->Log);
+        shader.CompileJob.reset();
+    }
+    else
+    {
+        glGetShaderiv(shader.Handle, GL_COMPILE_STATUS, &status);
+        if (!status)
+        {
+            log_s = GetShaderLog(shader.Handle);
+        }
+        // includes the status query, since drivers can defer compiling until then
+        shader.CompileTime = GetTimeNanoseconds() - shader.CompileStart;
+    }
+
+    shader.CompileStatus = status;
+    shader.CompileCount++;
+    if (mEventSink)
+    {
+        mEventSink->ShaderCompiled(GetShaderStats(shaderID));
+    }
+    if (!status)
+    {
+        fprintf(stderr, "Error compiling %s:\n%s\n", shader.Name.c_str(), ResolveLog(log_s).c_str());
+    }
+}
+
+void ShaderSet::LinkProgram(ProgramID programID)
+{
+    Program& program = mPrograms[programID];
+    program.LinkStart = GetTimeNanoseconds();
+
+    bool cacheBinary = !mProgramBinaryCacheDirectory.empty();
+    if (cacheBinary)
+    {
+        // remember which sources this link is for, since they might change again before an asynchronous link finishes
+        program.BinaryCacheKey = ProgramBinaryCacheKey(program);
+    }
+
+    if (mWorkers)
+    {
+        if (program.LinkJob)
+        {
+            // a previous link is still in flight, but it's already out of date.
+            mStaleJobs.push_back(std::move(program.LinkJob));
+        }
+        else
+        {
+            mLinkingPrograms.push_back(programID);
+        }
+
+        program.LinkJob = std::make_shared<WorkerJob>();
+        program.LinkJob->Type = WorkerJob::Link;
+        for (ShaderID shaderID : program.Shaders)
+        {
+            program.LinkJob->Shaders.push_back(mShaders[shaderID].Handle);
+        }
+        program.LinkJob->BinaryRetrievable = cacheBinary;
+        program.LinkJob->Separable = program.Separable;
+        mWorkers->Submit(program.LinkJob);
+        return;
+    }
+
+    // links into a fresh program object, so the public program stays usable while it's linking, or if the link fails
+    auto linkFreshProgram = [this, &program, cacheBinary]
+    {
+        program.LinkingHandle = glCreateProgram();
+        for (ShaderID shaderID : program.Shaders)
+        {
+            glAttachShader(program.LinkingHandle, mShaders[shaderID].Handle);
+        }
+        if (cacheBinary)
+        {
+            glProgramParameteri(program.LinkingHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+        if (program.Separable)
+        {
+            glProgramParameteri(program.LinkingHandle, GL_PROGRAM_SEPARABLE, GL_TRUE);
+        }
+        glLinkProgram(program.LinkingHandle);
+    };
+
+    if (!mAsyncCompilation)
+    {
+        ShaderSetEventScope linkScope(mEventSink.get(), "ShaderSet::Link", mShaders[program.Shaders[0]].Name.c_str());
+
+        if (mKeepLastGoodProgram && program.PublicHandle != 0)
+        {
+            linkFreshProgram();
+            FinishLink(programID);
+            return;
+        }
+
+        // shaders that were released and recreated aren't attached anymore
+        if (program.ShadersDetached)
+        {
+            for (ShaderID shaderID : program.Shaders)
+            {
+                if (!IsShaderAttached(program.InternalHandle, mShaders[shaderID].Handle))
+                {
+                    glAttachShader(program.InternalHandle, mShaders[shaderID].Handle);
+                }
+            }
+            program.ShadersDetached = false;
+        }
+        if (cacheBinary)
+        {
+            glProgramParameteri(program.InternalHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+        glLinkProgram(program.InternalHandle);
+        program.LinkingHandle = program.InternalHandle;
+        FinishLink(programID);
+        return;
+    }
+
+    // the public program stays usable without waiting for the link to finish.
+    if (program.LinkingHandle)
+    {
+        // a previous link is still in flight, but it's already out of date.
+        glDeleteProgram(program.LinkingHandle);
+    }
+    else
+    {
+        mLinkingPrograms.push_back(programID);
+    }
+
+    linkFreshProgram();
+}
+
+void ShaderSet::PrintProgramShaders(const Program& program) const
+{
+    fprintf(stderr, " program (");
+    for (ShaderID shaderID : program.Shaders)
+    {
+        if (shaderID != program.Shaders.front())
+        {
+            fprintf(stderr, ", ");
+        }
+
+        fprintf(stderr, "%s", mShaders[shaderID].Name.c_str());
+    }
+    fprintf(stderr, ")");
+
+    // all the shaders of a program are the same variant
+    const std::vector<std::string>& defines = mShaders[program.Shaders.front()].Defines;
+    for (const std::string& define : defines)
+    {
+        fprintf(stderr, "%s%s", define == defines.front() ? " [" : ", ", define.c_str());
+    }
+    if (!defines.empty())
+    {
+        fprintf(stderr, "]");
+    }
+    const ShaderConstants& constants = mShaders[program.Shaders.front()].Constants;
+    for (const std::pair<std::string, int32_t>& constant : constants)
+    {
+        fprintf(stderr, "%s%s=%d", constant == constants.front() ? " {" : ", ", constant.first.c_str(), (int)constant.second);
+    }
+    if (!constants.empty())
+    {
+        fprintf(stderr, "}");
+    }
+}
+
+void ShaderSet::FinishLink(ProgramID programID)
+{
+    Program& program = mPrograms[programID];
+
+    GLint status;
+    std::string log_s;
+    if (program.LinkJob)
+    {
+        program.LinkingHandle = program.LinkJob->Program;
+        program.LinkTime = program.LinkJob->Duration;
+        status = program.LinkJob->Status;
+        log_s = std::move(program.LinkJob->Log);
+        glDeleteSync(program.LinkJob->Fence);
+        program.LinkJob.reset();
+    }
+    else
+    {
+        glGetProgramiv(program.LinkingHandle, GL_LINK_STATUS, &status);
+        log_s = GetProgramLog(program.LinkingHandle);
+        program.LinkTime = GetTimeNanoseconds() - program.LinkStart;
+    }
+
+    program.LinkCount++;
+    program.LoadedFromCache = false;
+    program.LinkSucceeded = status != 0;
+
+    // a failed relink can leave the previous version in use (see SetKeepLastGoodProgram)
+    bool keepPrevious = !status && mKeepLastGoodProgram && program.PublicHandle != 0 && program.LinkingHandle != program.InternalHandle;
+    if (keepPrevious)
+    {
+        glDeleteProgram(program.LinkingHandle);
+    }
+    else if (program.LinkingHandle != program.InternalHandle)
+    {
+        // the previous version might still be recording on other threads, or be used by frames in flight
+        RetireProgramObject(program.InternalHandle);
+        program.InternalHandle = program.LinkingHandle;
+        program.ShadersDetached = false;
+    }
+    program.LinkingHandle = 0;
+    bool hasLog = !log_s.empty();
+    if (hasLog)
+    {
+        log_s = ResolveLog(log_s);
+    }
+
+    if (!status)
+    {
+        fprintf(stderr, "Error linking");
+    }
+    else
+    {
+        fprintf(stderr, "Successfully linked");
+    }
+
+    PrintProgramShaders(program);
+    if (hasLog)
+    {
+        fprintf(stderr, ":\n%s\n", log_s.c_str());
+    }
+    else
+    {
+        fprintf(stderr, "\n");
+    }
+
+    if (keepPrevious)
+    {
+        fprintf(stderr, "Keeping the previous version of the program until the errors are fixed\n");
+    }
+    else if (!status)
+    {
+        PublishHandles(program, 0);
+    }
+    else
+    {
+        PublishHandles(program, program.InternalHandle);
+        if (mReflection)
+        {
+            ReflectProgram(programID);
+        }
+        ResetGpuTiming(programID);
+
+        if (!mProgramBinaryCacheDirectory.empty())
+        {
+            SaveCachedProgram(program);
+        }
+
+        if (mReleaseShaderObjects)
+        {
+            ReleaseShaderObjects(programID);
+        }
+    }
+
+    // the stages of pipelines are changes of their pipelines
+    if (program.Separable)
+    {
+        program.Generation++;
+    }
+    else
+    {
+        AddProgramChange(program, status != 0);
+    }
+    UpdatePipelines(programID, status != 0);
+
+    if (mEventSink)
+    {
+        mEventSink->ProgramLinked(GetProgramStats(programID));
+    }
+}
+
+// the header of the files in the program binary cache, stored as little-endian integers in this order
+struct ProgramBinaryCacheHeader
+{
+    uint32_t Magic;
+    uint32_t BinaryLength;
+    uint64_t Key;
+    uint32_t BinaryFormat;
+};
+
+static const uint32_t kProgramBinaryCacheMagic = 0x32505353; // "SSP2", since the files of the first version had a native layout
+static const size_t kProgramBinaryCacheHeaderSize = 20;
+
+std::string ShaderSet::ProgramBinaryCacheFilename(uint64_t key) const
+{
+    char filename[32];
+    snprintf(filename, sizeof(filename), "%016llx.bin", (unsigned long long)key);
+    return mProgramBinaryCacheDirectory + "/" + filename;
+}
+
+std::string ShaderSet::SpirvCacheFilename(uint64_t sourceHash) const
+{
+    if (mSpirvCacheDirectory.empty())
+    {
+        return "";
+    }
+
+    char filename[32];
+    snprintf(filename, sizeof(filename), "%016llx.spv", (unsigned long long)sourceHash);
+    return mSpirvCacheDirectory + "/" + filename;
+}
+
+uint64_t ShaderSet::ProgramBinaryCacheKey(const Program& program) const
+{
+    // the driver identification is part of the key, since binaries are only valid for the driver that produced them.
+    uint64_t key = HashBytes(&program.Separable, sizeof(program.Separable), mDriverHash);
+    for (ShaderID shaderID : program.Shaders)
+    {
+        const Shader& shader = mShaders[shaderID];
+        key = HashBytes(&shader.Type, sizeof(shader.Type), key);
+        key = HashBytes(&shader.SourceHash, sizeof(shader.SourceHash), key);
+    }
+    return key;
+}
+
+// reads a program binary from its cache file, returning false if it's missing or isn't the binary for that key
+static bool ReadProgramBinaryCacheFile(const std::string& filename, uint64_t key, GLenum& binaryFormat, std::vector<char>& binary)
+{
+    std::ifstream ifs(filename, std::ios::binary);
+    if (!ifs)
+    {
+        return false;
+    }
+
+    char headerData[kProgramBinaryCacheHeaderSize];
+    if (!ifs.read(headerData, sizeof(headerData)))
+    {
+        return false;
+    }
+
+    ProgramBinaryCacheHeader header;
+    header.Magic = (uint32_t)ReadLittleEndian(headerData, 4);
+    header.BinaryLength = (uint32_t)ReadLittleEndian(headerData + 4, 4);
+    header.Key = ReadLittleEndian(headerData + 8, 8);
+    header.BinaryFormat = (uint32_t)ReadLittleEndian(headerData + 16, 4);
+    if (header.Magic != kProgramBinaryCacheMagic || header.Key != key)
+    {
+        return false;
+    }
+
+    binary.resize(header.BinaryLength);
+    if (!ifs.read(binary.data(), binary.size()))
+    {
+        return false;
+    }
+
+    binaryFormat = header.BinaryFormat;
+    return true;
+}
+
+bool ShaderSet::LoadCachedProgram(ProgramID programID)
+{
+    Program& program = mPrograms[programID];
+    uint64_t key = ProgramBinaryCacheKey(program);
+    uint64_t loadStart = GetTimeNanoseconds();
+
+    // binaries packed in the archive are used in place, otherwise they're read from the cache directory
+    const char* binaryData;
+    size_t binaryLength;
+    GLenum binaryFormat;
+    std::vector<char> binary;
+    const Archive::Entry* archivedBinary = nullptr;
+    if (mArchive)
+    {
+        auto foundBinary = mArchive->Programs.find(key);
+        if (foundBinary != mArchive->Programs.end())
+        {
+            archivedBinary = &foundBinary->second;
+        }
+    }
+
+    if (archivedBinary)
+    {
+        binaryData = archivedBinary->Data;
+        binaryLength = archivedBinary->Length;
+        binaryFormat = archivedBinary->BinaryFormat;
+    }
+    else if (!mProgramBinaryCacheDirectory.empty() && ReadProgramBinaryCacheFile(ProgramBinaryCacheFilename(key), key, binaryFormat, binary))
+    {
+        binaryData = binary.data();
+        binaryLength = binary.size();
+    }
+    else
+    {
+        return false;
+    }
+
+    // load into a new program object, so that a binary rejected by the driver doesn't break the currently linked program.
+    ProgramHandle handle = glCreateProgram();
+    if (program.Separable)
+    {
+        glProgramParameteri(handle, GL_PROGRAM_SEPARABLE, GL_TRUE);
+    }
+    glProgramBinary(handle, binaryFormat, binaryData, (GLsizei)binaryLength);
+
+    GLint status;
+    glGetProgramiv(handle, GL_LINK_STATUS, &status);
+    if (!status)
+    {
+        // probably a driver update, so fall back to compiling from source (and the cache entry gets rewritten after linking).
+        glDeleteProgram(handle);
+        return false;
+    }
+
+    // keep the shaders attached, so the program can be relinked from source when they change
+    program.ShadersDetached = false;
+    for (ShaderID shaderID : program.Shaders)
+    {
+        if (mShaders[shaderID].Handle)
+        {
+            glAttachShader(handle, mShaders[shaderID].Handle);
+        }
+        else
+        {
+            program.ShadersDetached = true;
+        }
+    }
+
+    // a link still in flight is now out of date
+    if (program.LinkingHandle || program.LinkJob)
+    {
+        if (program.LinkJob)
+        {
+            mStaleJobs.push_back(std::move(program.LinkJob));
+        }
+        else
+        {
+            glDeleteProgram(program.LinkingHandle);
+            program.LinkingHandle = 0;
+        }
+        mLinkingPrograms.erase(std::find(mLinkingPrograms.begin(), mLinkingPrograms.end(), programID));
+    }
+
+    RetireProgramObject(program.InternalHandle);
+    program.InternalHandle = handle;
+    PublishHandles(program, handle);
+    if (mReflection)
+    {
+        ReflectProgram(programID);
+    }
+    ResetGpuTiming(programID);
+    program.CompilesIssued = false;
+
+    if (program.Separable)
+    {
+        program.Generation++;
+    }
+    else
+    {
+        AddProgramChange(program, true);
+    }
+    UpdatePipelines(programID, true);
+
+    program.LinkCount++;
+    program.LinkTime = GetTimeNanoseconds() - loadStart;
+    program.LoadedFromCache = true;
+    program.LinkSucceeded = true;
+    if (mEventSink)
+    {
+        mEventSink->ProgramLinked(GetProgramStats(programID));
+    }
+
+    fprintf(stderr, "Loaded cached");
+    PrintProgramShaders(program);
+    fprintf(stderr, "\n");
+
+    return true;
+}
+
+void ShaderSet::SaveCachedProgram(const Program& program)
+{
+    GLint binaryLength = 0;
+    glGetProgramiv(program.InternalHandle, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+    if (binaryLength <= 0)
+    {
+        return;
+    }
+
+    std::vector<char> binary(binaryLength);
+    GLsizei length = 0;
+    GLenum binaryFormat = 0;
+    glGetProgramBinary(program.InternalHandle, binaryLength, &length, &binaryFormat, binary.data());
+
+    std::string header;
+    WriteLittleEndian(header, kProgramBinaryCacheMagic, 4);
+    WriteLittleEndian(header, (uint32_t)length, 4);
+    WriteLittleEndian(header, program.BinaryCacheKey, 8);
+    WriteLittleEndian(header, binaryFormat, 4);
+
+    std::string filename = ProgramBinaryCacheFilename(program.BinaryCacheKey);
+    std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+    if (!ofs.write(header.data(), header.size()) || !ofs.write(binary.data(), length))
+    {
+        fprintf(stderr, "Failed to write program binary cache file %s\n", filename.c_str());
+    }
+}
+
+void ShaderSet::SetProgramBinaryCacheDirectory(const std::string& directory)
+{
+    mProgramBinaryCacheDirectory = directory;
+
+    if (!mProgramBinaryCacheDirectory.empty())
+    {
+        mDriverHash = GetDriverHash();
+    }
+}
+
+void ShaderSet::SetSpirvCompiler(ShaderSpirvCompiler compiler, const std::string& cacheDirectory)
+{
+    mSpirvCompiler = std::move(compiler);
+    mSpirvCacheDirectory = cacheDirectory;
+}
+
+void ShaderSet::SetIncludeSupport(bool includeSupport)
+{
+    mIncludeSupport = includeSupport;
+}
+
+// appends a resource unless it's a built-in (eg. gl_VertexID), removing the "[0]" suffix of arrays from its name
+static void AddReflectedResource(std::vector<ShaderProgramReflection::Resource>& resources, const char* name, GLint location, GLenum type, GLint size)
+{
+    if (strncmp(name, "gl_", 3) == 0)
+    {
+        return;
+    }
+
+    ShaderProgramReflection::Resource resource;
+    resource.Name = name;
+    if (resource.Name.size() > 3 && resource.Name.compare(resource.Name.size() - 3, 3, "[0]") == 0)
+    {
+        resource.Name.resize(resource.Name.size() - 3);
+    }
+    resource.NameHash = HashBytes(resource.Name.data(), resource.Name.size(), 0);
+    resource.Location = location;
+    resource.Type = type;
+    resource.Size = size;
+    resources.push_back(std::move(resource));
+}
+
+static GLint FindReflectedResource(const std::vector<ShaderProgramReflection::Resource>& resources, const char* name)
+{
+    size_t length = strlen(name);
+    uint64_t nameHash = HashBytes(name, length, 0);
+
+    auto found = std::lower_bound(resources.begin(), resources.end(), nameHash,
+        [](const ShaderProgramReflection::Resource& resource, uint64_t hash) { return resource.NameHash < hash; });
+    for (; found != resources.end() && found->NameHash == nameHash; ++found)
+    {
+        if (found->Name.size() == length && found->Name.compare(0, length, name) == 0)
+        {
+            return found->Location;
+        }
+    }
+    return -1;
+}
+
+GLint ShaderProgramReflection::GetUniformLocation(const char* name) const
+{
+    return FindReflectedResource(Uniforms, name);
+}
+
+GLint ShaderProgramReflection::GetAttributeLocation(const char* name) const
+{
+    return FindReflectedResource(Attributes, name);
+}
+
+GLint ShaderProgramReflection::GetUniformBlockIndex(const char* name) const
+{
+    return FindReflectedResource(UniformBlocks, name);
+}
+
+GLint ShaderProgramReflection::GetStorageBlockIndex(const char* name) const
+{
+    return FindReflectedResource(StorageBlocks, name);
+}
+
+void ShaderSet::ReflectProgram(ProgramID programID)
+{
+    Program& program = mPrograms[programID];
+    ProgramHandle handle = program.PublicHandle;
+
+    ShaderProgramReflection& reflection = program.Reflection;
+    reflection.Uniforms.clear();
+    reflection.Attributes.clear();
+    reflection.UniformBlocks.clear();
+    reflection.StorageBlocks.clear();
+    reflection.Generation++;
+
+    // one buffer for all names, big enough for the longest name of each kind
+    GLint maxNameLength = 0;
+    for (GLenum pname : { GL_ACTIVE_UNIFORM_MAX_LENGTH, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH })
+    {
+        GLint length = 0;
+        glGetProgramiv(handle, pname, &length);
+        maxNameLength = std::max(maxNameLength, length);
+    }
+    std::vector<char> name(maxNameLength + 1);
+
+    GLint count = 0;
+    glGetProgramiv(handle, GL_ACTIVE_UNIFORMS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        GLint size;
+        GLenum type;
+        name[0] = '\0';
+        glGetActiveUniform(handle, (GLuint)i, (GLsizei)name.size(), NULL, &size, &type, name.data());
+        // uniforms of blocks have no location, and are found through their block
+        GLint location = glGetUniformLocation(handle, name.data());
+        if (location != -1)
+        {
+            AddReflectedResource(reflection.Uniforms, name.data(), location, type, size);
+        }
+    }
+
+    count = 0;
+    glGetProgramiv(handle, GL_ACTIVE_ATTRIBUTES, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        GLint size;
+        GLenum type;
+        name[0] = '\0';
+        glGetActiveAttrib(handle, (GLuint)i, (GLsizei)name.size(), NULL, &size, &type, name.data());
+        AddReflectedResource(reflection.Attributes, name.data(), glGetAttribLocation(handle, name.data()), type, size);
+    }
+
+    count = 0;
+    glGetProgramiv(handle, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        GLint dataSize = 0;
+        name[0] = '\0';
+        glGetActiveUniformBlockName(handle, (GLuint)i, (GLsizei)name.size(), NULL, name.data());
+        glGetActiveUniformBlockiv(handle, (GLuint)i, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+        AddReflectedResource(reflection.UniformBlocks, name.data(), i, 0, dataSize);
+    }
+
+#ifdef GL_SHADER_STORAGE_BLOCK
+    count = 0;
+    glGetProgramInterfaceiv(handle, GL_SHADER_STORAGE_BLOCK, GL_ACTIVE_RESOURCES, &count);
+    if (count > 0)
+    {
+        GLint maxStorageNameLength = 0;
+        glGetProgramInterfaceiv(handle, GL_SHADER_STORAGE_BLOCK, GL_MAX_NAME_LENGTH, &maxStorageNameLength);
+        name.resize(std::max((size_t)maxStorageNameLength + 1, name.size()));
+    }
+    for (GLint i = 0; i < count; i++)
+    {
+        const GLenum props[] = { GL_BUFFER_DATA_SIZE };
+        GLint dataSize = 0;
+        name[0] = '\0';
+        glGetProgramResourceName(handle, GL_SHADER_STORAGE_BLOCK, (GLuint)i, (GLsizei)name.size(), NULL, name.data());
+        glGetProgramResourceiv(handle, GL_SHADER_STORAGE_BLOCK, (GLuint)i, 1, props, 1, NULL, &dataSize);
+        AddReflectedResource(reflection.StorageBlocks, name.data(), i, 0, dataSize);
+    }
+#endif
+
+    for (std::vector<ShaderProgramReflection::Resource>* resources : { &reflection.Uniforms, &reflection.Attributes, &reflection.UniformBlocks, &reflection.StorageBlocks })
+    {
+        std::sort(resources->begin(), resources->end(), [](const ShaderProgramReflection::Resource& a, const ShaderProgramReflection::Resource& b)
+        {
+            return a.NameHash < b.NameHash;
+        });
+    }
+}
+
+void ShaderSet::SetGpuTiming(bool gpuTiming)
+{
+    mGpuTiming = gpuTiming;
+}
+
+void ShaderSet::BeginGpuTiming(const GLuint* program)
+{
+    if (!mGpuTiming)
+    {
+        return;
+    }
+    if (mGpuTimerActive)
+    {
+        fprintf(stderr, "BeginGpuTiming: the previous timing wasn't ended\n");
+        return;
+    }
+
+    auto foundProgram = mProgramHandleIndex.find(program);
+    if (foundProgram == mProgramHandleIndex.end())
+    {
+        return;
+    }
+
+    // the queries are recycled once their result is read back, so there are only as many as the GPU is behind
+    GLuint query;
+    if (mFreeGpuQueries.empty())
+    {
+        glGenQueries(1, &query);
+    }
+    else
+    {
+        query = mFreeGpuQueries.back();
+        mFreeGpuQueries.pop_back();
+    }
+
+    mActiveGpuTimer.Query = query;
+    mActiveGpuTimer.Program = foundProgram->second;
+    mActiveGpuTimer.Version = mPrograms[foundProgram->second].GpuTimingVersion;
+    mGpuTimerActive = true;
+    glBeginQuery(GL_TIME_ELAPSED, query);
+}
+
+void ShaderSet::EndGpuTiming()
+{
+    if (!mGpuTimerActive)
+    {
+        return;
+    }
+
+    glEndQuery(GL_TIME_ELAPSED);
+    mPendingGpuTimers.push_back(mActiveGpuTimer);
+    mGpuTimerActive = false;
+}
+
+void ShaderSet::ReadGpuTimers()
+{
+    // the queries finish in the order they were issued
+    while (!mPendingGpuTimers.empty())
+    {
+        const GpuTimer& timer = mPendingGpuTimers.front();
+
+        GLint available = 0;
+        glGetQueryObjectiv(timer.Query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+        {
+            break;
+        }
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(timer.Query, GL_QUERY_RESULT, &elapsed);
+
+        if (timer.Program != UINT32_MAX)
+        {
+            // the work timed before a relink was done with the previous version
+            Program& program = mPrograms[timer.Program];
+            if (timer.Version == program.GpuTimingVersion)
+            {
+                program.GpuTime += elapsed;
+                program.GpuTimeSamples++;
+            }
+            else if (timer.Version + 1 == program.GpuTimingVersion)
+            {
+                program.PreviousGpuTime += elapsed;
+                program.PreviousGpuTimeSamples++;
+            }
+        }
+
+        mFreeGpuQueries.push_back(timer.Query);
+        mPendingGpuTimers.pop_front();
+    }
+}
+
+void ShaderSet::ResetGpuTiming(ProgramID programID)
+{
+    Program& program = mPrograms[programID];
+    program.PreviousGpuTime = program.GpuTime;
+    program.PreviousGpuTimeSamples = program.GpuTimeSamples;
+    program.GpuTime = 0;
+    program.GpuTimeSamples = 0;
+    program.GpuTimingVersion++;
+}
+
+void ShaderSet::SetKeepLastGoodProgram(bool keepLastGoodProgram)
+{
+    mKeepLastGoodProgram = keepLastGoodProgram;
+}
+
+void ShaderSet::SetRetireDelay(uint32_t numUpdates)
+{
+    mRetireDelay = numUpdates;
+}
+
+void ShaderSet::RetireProgramObject(ProgramHandle handle)
+{
+    if (handle)
+    {
+        mRetiredPrograms.emplace_back(handle, mUpdateCount);
+    }
+}
+
+void ShaderSet::SetReleaseShaderObjects(bool releaseShaderObjects)
+{
+    mReleaseShaderObjects = releaseShaderObjects;
+}
+
+void ShaderSet::SetReflection(bool reflection)
+{
+    mReflection = reflection;
+}
+
+const ShaderProgramReflection* ShaderSet::GetReflection(const GLuint* program) const
+{
+    auto foundProgram = mProgramHandleIndex.find(program);
+    if (!mReflection || foundProgram == mProgramHandleIndex.end())
+    {
+        return nullptr;
+    }
+    return &mPrograms[foundProgram->second].Reflection;
+}
+
+void ShaderSet::SetQuietPeriod(uint64_t quietPeriod)
+{
+    mQuietPeriod = quietPeriod;
+}
+
+void ShaderSet::SetContentHashing(bool contentHashing)
+{
+    mContentHashing = contentHashing;
+}
+
+void ShaderSet::MarkProgramUsed(const GLuint* program)
+{
+    // the next update counts as more recent than any update before it
+    auto markUsed = [this](ProgramID programID)
+    {
+        // each program is polled once per update, no matter how many times it's used
+        if (mPrograms[programID].LastUsed != mUpdateCount + 1)
+        {
+            mPrograms[programID].LastUsed = mUpdateCount + 1;
+            if (mPollsPerUpdate != 0)
+            {
+                mUsedPrograms.push_back(programID);
+            }
+        }
+    };
+
+    auto foundProgram = mProgramHandleIndex.find(program);
+    if (foundProgram != mProgramHandleIndex.end())
+    {
+        markUsed(foundProgram->second);
+    }
+
+    auto foundPipeline = mPipelineHandleIndex.find(program);
+    if (foundPipeline != mPipelineHandleIndex.end())
+    {
+        for (ProgramID stageID : mPipelines[foundPipeline->second].Stages)
+        {
+            markUsed(stageID);
+        }
+    }
+}
+
+ShaderSetProgress ShaderSet::GetProgress() const
+{
+    ShaderSetProgress progress;
+    // the shaders changed, being read, or waiting for the quiet period to end (see SetQuietPeriod), themselves or through their included files
+    std::vector<ShaderID> shadersToRead = mUpdatedShaders;
+    shadersToRead.insert(shadersToRead.end(), mReadingShaders.begin(), mReadingShaders.end());
+    shadersToRead.insert(shadersToRead.end(), mSettlingShaders.begin(), mSettlingShaders.end());
+    for (IncludeID includeID : mSettlingIncludes)
+    {
+        const std::vector<ShaderID>& dependents = mIncludeFiles[includeID].Dependents;
+        shadersToRead.insert(shadersToRead.end(), dependents.begin(), dependents.end());
+    }
+    std::sort(shadersToRead.begin(), shadersToRead.end());
+    progress.ShadersToRead = (uint32_t)(std::unique(shadersToRead.begin(), shadersToRead.end()) - shadersToRead.begin());
+    progress.ProgramsToLink = (uint32_t)(mProgramsToLink.size() + mLinkingPrograms.size());
+
+    // the shaders compiling, and those that will be compiled for the programs to link (counting shared shaders once)
+    std::vector<ShaderID> shadersToCompile = mCompilingShaders;
+    for (ProgramID programID : mProgramsToLink)
+    {
+        for (ShaderID shaderID : mPrograms[programID].Shaders)
+        {
+            if (mShaders[shaderID].NeedsCompile)
+            {
+                shadersToCompile.push_back(shaderID);
+            }
+        }
+    }
+    std::sort(shadersToCompile.begin(), shadersToCompile.end());
+    progress.ShadersToCompile = (uint32_t)(std::unique(shadersToCompile.begin(), shadersToCompile.end()) - shadersToCompile.begin());
+
+    return progress;
+}
+
+bool ShaderSet::IsProgramReady(const GLuint* program) const
+{
+    auto isReady = [this](ProgramID programID)
+    {
+        const Program& stage = mPrograms[programID];
+        return !stage.NeedsLink && !stage.LinkingHandle && !stage.LinkJob;
+    };
+
+    auto foundPipeline = mPipelineHandleIndex.find(program);
+    if (foundPipeline != mPipelineHandleIndex.end())
+    {
+        const std::vector<ProgramID>& stages = mPipelines[foundPipeline->second].Stages;
+        return std::all_of(stages.begin(), stages.end(), isReady);
+    }
+
+    // programs added concurrently aren't found until the next update adds them
+    auto foundProgram = mProgramHandleIndex.find(program);
+    return foundProgram != mProgramHandleIndex.end() && isReady(foundProgram->second);
+}
+
+std::vector<ShaderProgramChange> ShaderSet::Prewarm(const std::function<void(const ShaderSetProgress& progress)>& progressCallback)
+{
+    ShaderSetEventScope prewarmScope(mEventSink.get(), "ShaderSet::Prewarm", nullptr);
+
+    std::vector<ShaderProgramChange> changes;
+    for (;;)
+    {
+        const std::vector<ShaderProgramChange>& updateChanges = UpdatePrograms();
+        changes.insert(changes.end(), updateChanges.begin(), updateChanges.end());
+
+        ShaderSetProgress progress = GetProgress();
+        if (progressCallback)
+        {
+            progressCallback(progress);
+        }
+        if (progress.ShadersToRead == 0 && progress.ShadersToCompile == 0 && progress.ProgramsToLink == 0)
+        {
+            break;
+        }
+
+        // wait a bit for the workers or the driver, rather than spinning on the completion queries
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return changes;
+}
+
+void ShaderSet::SetEventSink(std::unique_ptr<ShaderSetEventSink> eventSink)
+{
+    mEventSink = std::move(eventSink);
+}
+
+ShaderStats ShaderSet::GetShaderStats(ShaderID shaderID) const
+{
+    const Shader& shader = mShaders[shaderID];
+
+    ShaderStats stats;
+    stats.Name = shader.Name;
+    stats.Type = shader.Type;
+    stats.Defines = shader.Defines;
+    stats.Constants = shader.Constants;
+    stats.ReloadCount = shader.ReloadCount;
+    stats.CompileCount = shader.CompileCount;
+    stats.SourceSize = shader.SourceSize;
+    stats.ReadTime = shader.ReadTime;
+    stats.CompileTime = shader.CompileTime;
+    stats.CompileSucceeded = shader.CompileStatus != 0;
+    return stats;
+}
+
+ShaderProgramStats ShaderSet::GetProgramStats(ProgramID programID) const
+{
+    const Program& program = mPrograms[programID];
+
+    ShaderProgramStats stats;
+    stats.Program = &program.PublicHandle;
+    for (ShaderID shaderID : program.Shaders)
+    {
+        stats.Shaders.push_back(mShaders[shaderID].Name);
+    }
+    stats.LinkCount = program.LinkCount;
+    stats.LinkTime = program.LinkTime;
+    stats.LoadedFromCache = program.LoadedFromCache;
+    stats.LinkSucceeded = program.LinkSucceeded;
+    stats.GpuTime = program.GpuTime;
+    stats.GpuTimeSamples = program.GpuTimeSamples;
+    stats.PreviousGpuTime = program.PreviousGpuTime;
+    stats.PreviousGpuTimeSamples = program.PreviousGpuTimeSamples;
+    return stats;
+}
+
+ShaderSetStats ShaderSet::GetStats() const
+{
+    ShaderSetStats stats;
+    stats.Shaders.reserve(mShaders.size());
+    for (ShaderID shaderID = 0; shaderID < (ShaderID)mShaders.size(); shaderID++)
+    {
+        if (!mShaders[shaderID].Removed)
+        {
+            stats.Shaders.push_back(GetShaderStats(shaderID));
+        }
+    }
+    stats.Programs.reserve(mPrograms.size());
+    for (ProgramID programID = 0; programID < (ProgramID)mPrograms.size(); programID++)
+    {
+        if (!mPrograms[programID].Removed)
+        {
+            stats.Programs.push_back(GetProgramStats(programID));
+        }
+    }
+    stats.UpdateTime = mUpdateTime;
+    return stats;
+}
+
+void ShaderSet::SetWorkerThreads(int numThreads, const ShaderWorkerContextCallbacks& callbacks)
+{
+    // the previous workers finish what they were given, and their results get picked up by the next updates.
+    mWorkers.reset();
+
+    if (numThreads > 0 && (!callbacks.CreateContext || !callbacks.MakeCurrent || !callbacks.DestroyContext))
+    {
+        fprintf(stderr, "The worker context callbacks are incomplete, so the shaders are compiled without worker threads\n");
+        return;
+    }
+
+    if (numThreads > 0)
+    {
+        mWorkers.reset(new WorkerPool(numThreads, callbacks));
+        if (mWorkers->Threads.empty())
+        {
+            mWorkers.reset();
+        }
+    }
+}
+
+void ShaderSet::SetSeparablePrograms(bool separablePrograms)
+{
+    mSeparablePrograms = separablePrograms;
+}
+
+void ShaderSet::SetAsyncCompilation(bool asyncCompilation)
+{
+    mAsyncCompilation = asyncCompilation;
+}
+
+void ShaderSet::SetFileWatcher(std::unique_ptr<ShaderFileWatcher> fileWatcher)
+{
+    mFileWatcher = std::move(fileWatcher);
+    mShadersToPoll.clear();
+    mUnwatchedShaders.clear();
+
+    if (mFileWatcher)
+    {
+        for (ShaderID shaderID = 0; shaderID < (ShaderID)mShaders.size(); shaderID++)
+        {
+            if (!mShaders[shaderID].Removed)
+            {
+                WatchShader(shaderID);
+            }
+        }
+        for (IncludeFile& includeFile : mIncludeFiles)
+        {
+            if (includeFile.Removed)
+            {
+                continue;
+            }
+            includeFile.Watched = mFileWatcher->Watch(includeFile.Name);
+            // the file might have changed before it started being watched
+            includeFile.NeedsPoll = true;
+        }
+        if (!mPreambleFilename.empty())
+        {
+            mPreambleWatched = mFileWatcher->Watch(mPreambleFilename);
+            mPreambleNeedsPoll = true;
+        }
+    }
+}
+
+void ShaderSet::WatchShader(ShaderID shaderID)
+{
+    if (mFileWatcher->Watch(mShaders[shaderID].Name))
+    {
+        // check the timestamp once, since the file might have changed before it started being watched
+        mShadersToPoll.push_back(shaderID);
+    }
+    else
+    {
+        mUnwatchedShaders.push_back(shaderID);
+    }
+}
+
+void ShaderSet::SetPreambleFile(const std::string& preambleFilename)
+{
+    if (!mArchive)
+    {
+        mPreambleTimestamp = GetShaderFileTimestamp(preambleFilename.c_str(), mPreambleFileSize);
+    }
+
+    std::string preamble;
+    ReadSourceFile(preambleFilename, preamble);
+    SetPreamble(preamble);
+    mPreambleFilename = preambleFilename;
+
+    if (mFileWatcher)
+    {
+        mPreambleWatched = mFileWatcher->Watch(mPreambleFilename);
+    }
+}
+
+void ShaderSet::RecycleShaderSource(Shader& shader)
+{
+    // the source usually holds the storage the file was read into, so the next files read don't allocate
+    if (shader.Source.capacity() > mReadBuffer.capacity())
+    {
+        mReadBuffer.swap(shader.Source);
+    }
+    std::string().swap(shader.Source);
+}
+
+void ShaderSet::ReadSourceFile(const std::string& filename, std::string& contents)
+{
+    auto foundOverride = mFileOverrides.find(filename);
+    if (foundOverride != mFileOverrides.end())
+    {
+        contents = foundOverride->second;
+        return;
+    }
+
+    if (!mArchive)
+    {
+        ReadShaderFile(filename.c_str(), contents);
+        return;
+    }
+
+    auto foundFile = mArchive->Files.find(filename);
+    if (foundFile == mArchive->Files.end())
+    {
+        fprintf(stderr, "File %s is not in the shader archive\n", filename.c_str());
+        contents.clear();
+        return;
+    }
+    contents.assign(foundFile->second.Data, foundFile->second.Length);
+}
+
+void ShaderSet::SetFileOverride(const std::string& filename, const std::string& contents)
+{
+    auto foundOverride = mFileOverrides.emplace(filename, contents);
+    if (!foundOverride.second)
+    {
+        if (foundOverride.first->second == contents)
+        {
+            return;
+        }
+        foundOverride.first->second = contents;
+    }
+    ReloadFile(filename);
+}
+
+void ShaderSet::ClearFileOverride(const std::string& filename)
+{
+    if (mFileOverrides.erase(filename))
+    {
+        ReloadFile(filename);
+    }
+}
+
+void ShaderSet::SetRemoteSource(std::unique_ptr<ShaderRemoteSource> remoteSource)
+{
+    mRemoteSource = std::move(remoteSource);
+}
+
+void ShaderSet::ReloadFile(const std::string& filename)
+{
+    auto foundShaders = mShaderFileIndex.find(filename);
+    if (foundShaders != mShaderFileIndex.end())
+    {
+        for (ShaderID shaderID : foundShaders->second)
+        {
+            if (!mShaders[shaderID].Removed)
+            {
+                MarkShaderUpdated(shaderID);
+            }
+        }
+    }
+
+    auto foundInclude = mIncludeIndex.find(filename);
+    if (foundInclude != mIncludeIndex.end())
+    {
+        IncludeFile& includeFile = mIncludeFiles[foundInclude->second];
+        ReadSourceFile(includeFile.Name, includeFile.Contents);
+        for (ShaderID dependent : includeFile.Dependents)
+        {
+            MarkShaderUpdated(dependent);
+        }
+    }
+
+    if (!mPreambleFilename.empty() && filename == mPreambleFilename)
+    {
+        std::string preamble;
+        ReadSourceFile(mPreambleFilename, preamble);
+        if (preamble != mPreamble)
+        {
+            mPreamble.swap(preamble);
+            mShaderHeaders.clear();
+            MarkAllShadersUpdated();
+        }
+    }
+}
+
+bool ShaderSet::WriteArchive(const std::string& filename, bool includeProgramBinaries)
+{
+    // the files of all shaders and included files, and the preamble file
+    std::vector<std::string> filenames;
+    for (const auto& shaderFile : mShaderFileIndex)
+    {
+        filenames.push_back(shaderFile.first);
+    }
+    for (const IncludeFile& includeFile : mIncludeFiles)
+    {
+        if (!includeFile.Removed)
+        {
+            filenames.push_back(includeFile.Name);
+        }
+    }
+    if (!mPreambleFilename.empty())
+    {
+        filenames.push_back(mPreambleFilename);
+    }
+    std::sort(filenames.begin(), filenames.end());
+    filenames.erase(std::unique(filenames.begin(), filenames.end()), filenames.end());
+
+    std::vector<ShaderArchiveEntry> entries;
+    std::string blob;
+    std::string contents;
+    for (const std::string& name : filenames)
+    {
+        ReadSourceFile(name, contents);
+
+        ShaderArchiveEntry entry = {};
+        entry.Kind = ShaderArchiveEntry::File;
+        entry.NameOffset = (uint32_t)blob.size();
+        entry.NameLength = (uint32_t)name.size();
+        blob += name;
+        entry.DataOffset = blob.size();
+        entry.DataLength = contents.size();
+        blob += contents;
+        entries.push_back(entry);
+    }
+
+    if (includeProgramBinaries)
+    {
+        uint64_t driverHash = mDriverHash;
+        mDriverHash = GetDriverHash();
+
+        for (const Program& program : mPrograms)
+        {
+            GLint binaryLength = 0;
+            if (program.PublicHandle != 0)
+            {
+                glGetProgramiv(program.InternalHandle, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+            }
+            if (binaryLength <= 0)
+            {
+                continue;
+            }
+
+            std::vector<char> binary(binaryLength);
+            GLsizei length = 0;
+            GLenum binaryFormat = 0;
+            glGetProgramBinary(program.InternalHandle, binaryLength, &length, &binaryFormat, binary.data());
+
+            ShaderArchiveEntry entry = {};
+            entry.Kind = ShaderArchiveEntry::ProgramBinary;
+            entry.Key = ProgramBinaryCacheKey(program);
+            entry.BinaryFormat = binaryFormat;
+            entry.DataOffset = blob.size();
+            entry.DataLength = (uint64_t)length;
+            blob.append(binary.data(), length);
+            entries.push_back(entry);
+        }
+
+        mDriverHash = driverHash;
+    }
+
+    // make the offsets relative to the start of the file
+    uint64_t blobOffset = kShaderArchiveHeaderSize + entries.size() * kShaderArchiveEntrySize;
+    std::string header;
+    WriteLittleEndian(header, kShaderArchiveMagic, 4);
+    WriteLittleEndian(header, entries.size(), 4);
+    for (ShaderArchiveEntry& entry : entries)
+    {
+        entry.DataOffset += blobOffset;
+        entry.NameOffset += (uint32_t)blobOffset;
+        WriteArchiveEntry(header, entry);
+    }
+
+    std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+    if (!ofs.write(header.data(), header.size()) || !ofs.write(blob.data(), blob.size()))
+    {
+        fprintf(stderr, "Failed to write shader archive %s\n", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool ShaderSet::LoadArchive(const std::string& filename)
+{
+    // the shaders added already read the file system, and would never be read from the archive
+    bool programsAdded = !mShaders.empty() || !mPrograms.empty();
+    {
+        std::lock_guard<std::mutex> lock(mRegistrationMutex);
+        programsAdded = programsAdded || !mPendingPrograms.empty();
+    }
+    if (programsAdded)
+    {
+        fprintf(stderr, "Shader archive %s must be loaded before adding programs\n", filename.c_str());
+        return false;
+    }
+
+    std::unique_ptr<Archive> archive(new Archive());
+    if (!archive->Map(filename.c_str()) || !archive->Index())
+    {
+        fprintf(stderr, "Failed to load shader archive %s\n", filename.c_str());
+        return false;
+    }
+
+    mArchive = std::move(archive);
+    if (!mArchive->Programs.empty())
+    {
+        mDriverHash = GetDriverHash();
+    }
+    return true;
+}
+
+GLuint* ShaderSet::AddProgramFromExts(const std::vector<std::string>& shaders, const std::vector<std::string>& defines, const ShaderConstants& constants)
+{
+    std::vector<std::pair<std::string, GLenum>> typedShaders;
+    for (const std::string& shader : shaders)
+    {
+        // the stage of SPIR-V binaries is the extension before .spv
+        std::string stageName = EndsWith(shader, ".spv") ? shader.substr(0, shader.size() - 4) : shader;
+
+        size_t extLoc = stageName.find_last_of('.');
         if (extLoc == std::string::npos)
         {
             return nullptr;
@@ -331,7 +5071,7 @@ GLuint* ShaderSet::AddProgramFromExts(const std::vector<std::string>& shaders)
 
         GLenum shaderType;
 
-        std::string ext = shader.substr(extLoc + 1);
+        std::string ext = stageName.substr(extLoc + 1);
         if (ext == "vert")
             shaderType = GL_VERTEX_SHADER;
         else if (ext == "frag")
@@ -350,16 +5090,16 @@ GLuint* ShaderSet::AddProgramFromExts(const std::vector<std::string>& shaders)
         typedShaders.emplace_back(shader, shaderType);
     }
 
-    return AddProgram(typedShaders);
+    return AddProgram(typedShaders, defines, constants);
 }
 
-GLuint* ShaderSet::AddProgramFromCombinedFile(const std::string &filename, const std::vector<GLenum> &shaderTypes)
+GLuint* ShaderSet::AddProgramFromCombinedFile(const std::string &filename, const std::vector<GLenum> &shaderTypes, const std::vector<std::string>& defines, const ShaderConstants& constants)
 {
     std::vector<std::pair<std::string, GLenum>> typedShaders;
 
     for (auto type: shaderTypes)
         typedShaders.emplace_back(filename, type);
 
-    return AddProgram(typedShaders);
+    return AddProgram(typedShaders, defines, constants);
 }
 
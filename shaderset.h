@@ -3,11 +3,247 @@
 // Replace with your own GL header include
 #include "opengl.h"
 
+#include <cstdint>
 #include <vector>
 #include <utility>
-#include <map>
-#include <set>
+#include <deque>
+#include <unordered_map>
 #include <string>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Interface for a backend that reports changes to watched files.
+// When a ShaderSet has a file watcher, UpdatePrograms() only polls the timestamps of the files reported by it,
+// instead of polling the timestamp of every shader in the set.
+class ShaderFileWatcher
+{
+public:
+    virtual ~ShaderFileWatcher() = default;
+
+    // Start watching a file. Watching the same file more than once has no additional effect.
+    // Returns false if the file can't be watched, in which case the ShaderSet falls back to polling its timestamp.
+    virtual bool Watch(const std::string& filename) = 0;
+
+    // Appends the names (as passed to Watch()) of the files that might have changed since the last call.
+    // Reporting a file that didn't actually change is harmless. This must not block.
+    virtual void PollChanges(std::vector<std::string>& changedFiles) = 0;
+};
+
+// Creates the native file watcher of this platform (inotify on Linux, ReadDirectoryChangesW on Windows, kqueue on macOS/BSD)
+// Returns nullptr if the platform has none or if it failed to initialize.
+std::unique_ptr<ShaderFileWatcher> CreateNativeShaderFileWatcher();
+
+// Interface for a backend that receives the contents of changed files from another machine (see ShaderSet::SetRemoteSource),
+// for devices that don't share a file system with the machine where the shaders are edited.
+class ShaderRemoteSource
+{
+public:
+    virtual ~ShaderRemoteSource() = default;
+
+    // Appends the (file name, contents) of the files received since the last call. This must not block.
+    virtual void PollFiles(std::vector<std::pair<std::string, std::string>>& files) = 0;
+};
+
+// Creates a remote source that listens for a ShaderRemoteSender on a TCP port (one connection at a time.)
+// Connections aren't authenticated, so it only listens on the loopback interface by default, which the workstation can still reach through port forwarding (eg. adb forward).
+// Pass the address of another interface (or "0.0.0.0") to receive files over the network, on a trusted network only.
+// Returns nullptr if it failed to listen.
+std::unique_ptr<ShaderRemoteSource> CreateSocketShaderRemoteSource(uint16_t port, const std::string& bindAddress = "127.0.0.1");
+
+// Sends files to a remote source created by CreateSocketShaderRemoteSource() on another machine.
+// eg: a tool on the workstation that watches the shaders with CreateNativeShaderFileWatcher() and sends them as they're saved.
+class ShaderRemoteSender
+{
+public:
+    ShaderRemoteSender() = default;
+    ShaderRemoteSender(const ShaderRemoteSender&) = delete;
+    ShaderRemoteSender& operator=(const ShaderRemoteSender&) = delete;
+    ~ShaderRemoteSender();
+
+    // Connects to the device (eg. through "adb forward" for Android). Returns false if it couldn't connect.
+    bool Connect(const std::string& host, uint16_t port);
+
+    // Sends the contents of a file, named as the ShaderSet on the device names it. Blocks until it's sent, and returns false if the connection was lost.
+    // Only the part between the prefix and suffix it shares with the previous contents sent for the same file is transferred,
+    // compressed with a small LZ77 coder (which can also copy from the unchanged prefix), so edits of big files are sent quickly over slow links.
+    bool SendFile(const std::string& filename, const std::string& contents);
+
+private:
+    // a SOCKET on Windows, a file descriptor elsewhere
+    intptr_t mSocket = -1;
+    // the contents sent for each file over the current connection, which the deltas are computed from
+    std::unordered_map<std::string, std::string> mSentFiles;
+};
+
+// Callbacks that give the worker threads of a ShaderSet their own GL contexts (see ShaderSet::SetWorkerThreads)
+struct ShaderWorkerContextCallbacks
+{
+    // Called on the thread that calls SetWorkerThreads(), once per worker thread.
+    // Must return a new GL context that shares its objects with the current one (eg. created with wglCreateContextAttribsARB/glXCreateContextAttribsARB)
+    std::function<void*()> CreateContext;
+    // Called on a worker thread with its context before it does any GL call, and with nullptr just before the thread exits.
+    std::function<void(void* context)> MakeCurrent;
+    // Called on the thread that stops the workers (SetWorkerThreads() or the ShaderSet destructor), after the worker exited.
+    std::function<void(void* context)> DestroyContext;
+};
+
+// Named compile-time constants of a program, as (name, value) pairs (see ShaderSet::AddProgram)
+using ShaderConstants = std::vector<std::pair<std::string, int32_t>>;
+
+// Statistics of a shader. Times are in nanoseconds.
+struct ShaderStats
+{
+    std::string Name;
+    GLenum Type;
+    // The defines and constants of the variant (see ShaderSet::AddProgram)
+    std::vector<std::string> Defines;
+    ShaderConstants Constants;
+    // Number of times the file was read since the shader was added (including the first time)
+    uint32_t ReloadCount;
+    // Number of times the shader was compiled (reloads whose program binaries were cached don't need to compile)
+    uint32_t CompileCount;
+    // Size of the most recently read source (after resolving includes)
+    size_t SourceSize;
+    // Time taken by the most recent file read
+    uint64_t ReadTime;
+    // Time taken by the most recent compile.
+    // With async compilation, this is the time until the compile was seen done by UpdatePrograms(), so it depends on how often that's called.
+    uint64_t CompileTime;
+    // The GL_COMPILE_STATUS of the most recent compile
+    bool CompileSucceeded;
+};
+
+// Statistics of a program. Times are in nanoseconds.
+struct ShaderProgramStats
+{
+    // The handle returned by AddProgram()
+    const GLuint* Program;
+    // The names of the shaders linked into the program
+    std::vector<std::string> Shaders;
+    // Number of times the program was linked, or loaded from the program binary cache
+    uint32_t LinkCount;
+    // Time taken by the most recent link (same caveat as ShaderStats::CompileTime for async compilation)
+    uint64_t LinkTime;
+    // True if the most recent link was loaded from the program binary cache
+    bool LoadedFromCache;
+    // The GL_LINK_STATUS of the most recent link
+    bool LinkSucceeded;
+    // Total GPU time of the work timed with BeginGpuTiming()/EndGpuTiming() since the program was last relinked successfully,
+    // and the number of times it was timed. Divide one by the other for the average.
+    uint64_t GpuTime;
+    uint32_t GpuTimeSamples;
+    // Same, for the version of the program before the last successful relink, to compare the cost of an edit with the previous version.
+    uint64_t PreviousGpuTime;
+    uint32_t PreviousGpuTimeSamples;
+};
+
+// Snapshot of the statistics of a ShaderSet (see ShaderSet::GetStats)
+struct ShaderSetStats
+{
+    std::vector<ShaderStats> Shaders;
+    std::vector<ShaderProgramStats> Programs;
+    // Time taken by the most recent call to UpdatePrograms()
+    uint64_t UpdateTime;
+};
+
+// A program relinked by a call to UpdatePrograms() (see ShaderSet::UpdatePrograms)
+struct ShaderProgramChange
+{
+    // The handle returned by AddProgram*() (the handle of the program pipeline, when one of its stages was relinked)
+    const GLuint* Program;
+    // Incremented by every relink (or load from the program binary cache), so caches can tell which version they were built from
+    uint32_t Generation;
+    // False if the link failed, in which case the handle is 0 (or still the previous version, see SetKeepLastGoodProgram)
+    bool Succeeded;
+};
+
+// The work left for later calls to UpdatePrograms() (see ShaderSet::GetProgress)
+struct ShaderSetProgress
+{
+    // Shaders whose files (or included files) changed, but weren't read yet, including those waiting for the quiet period to end
+    uint32_t ShadersToRead;
+    // Shaders that need to be compiled for the programs to relink, or are being compiled
+    uint32_t ShadersToCompile;
+    // Programs waiting to be relinked, or being linked
+    uint32_t ProgramsToLink;
+};
+
+// Interface that receives the events of a ShaderSet, eg. to log them or forward them to a profiler.
+// All methods are called on the thread calling UpdatePrograms(), and do nothing by default.
+class ShaderSetEventSink
+{
+public:
+    virtual ~ShaderSetEventSink() = default;
+
+    // Called after the file of a shader was read
+    virtual void ShaderRead(const ShaderStats& /*stats*/) {}
+    // Called after a shader finished compiling
+    virtual void ShaderCompiled(const ShaderStats& /*stats*/) {}
+    // Called after a program finished linking, or was loaded from the program binary cache
+    virtual void ProgramLinked(const ShaderProgramStats& /*stats*/) {}
+
+    // Called around the work done by UpdatePrograms(), like the markers of a profiler (eg. Tracy zones)
+    // The name is a static string (eg. "ShaderSet::Compile"), and the detail is the related file name (or null).
+    // Scopes are properly nested, and only cover work done on the calling thread.
+    virtual void BeginScope(const char* /*name*/, const char* /*detail*/) {}
+    virtual void EndScope() {}
+};
+
+// The active uniforms, attributes and blocks of a linked program (see ShaderSet::GetReflection)
+struct ShaderProgramReflection
+{
+    struct Resource
+    {
+        // The name, without the "[0]" suffix of arrays
+        std::string Name;
+        uint64_t NameHash;
+        // The location of uniforms and attributes, or the index of blocks
+        GLint Location;
+        // The GL type and array size of uniforms and attributes. For blocks, the type is 0 and the size is the size of the block data in bytes.
+        GLenum Type;
+        GLint Size;
+    };
+
+    // Sorted by name hash
+    std::vector<Resource> Uniforms;
+    std::vector<Resource> Attributes;
+    std::vector<Resource> UniformBlocks;
+    std::vector<Resource> StorageBlocks;
+
+    // Changes every time the program is relinked, so locations only need to be looked up again when it changes
+    uint32_t Generation = 0;
+
+    // Lookups by name. Return -1 if the program has no such active resource.
+    GLint GetUniformLocation(const char* name) const;
+    GLint GetAttributeLocation(const char* name) const;
+    GLint GetUniformBlockIndex(const char* name) const;
+    GLint GetStorageBlockIndex(const char* name) const;
+};
+
+// A message of a compile or link log, with the file number of its location mapped back to the file name (see ShaderSet::SetDiagnosticCallback)
+struct ShaderDiagnostic
+{
+    enum SeverityType { Error, Warning, Info };
+
+    // The file and line of the message, if the log gave one (otherwise the file is empty and the line is 0.)
+    // Messages about the preamble are in the preamble file, or in "preamble" if it wasn't set from a file.
+    std::string File;
+    uint32_t Line;
+    // Messages without a severity are Info, eg. the summary lines of some compilers
+    SeverityType Severity;
+    std::string Message;
+};
+
+using ShaderDiagnosticCallback = std::function<void(const ShaderDiagnostic& diagnostic)>;
+
+// Translates the GLSL source of a shader to SPIR-V (eg. with glslang), for drivers that are better at consuming SPIR-V (see ShaderSet::SetSpirvCompiler)
+// Returns false and fills the log if the source has errors.
+using ShaderSpirvCompiler = std::function<bool(const std::string& source, GLenum type, std::vector<uint32_t>& spirv, std::string& log)>;
 
 class ShaderSet
 {
@@ -15,23 +251,142 @@ class ShaderSet
     using ShaderHandle = GLuint;
     using ProgramHandle = GLuint;
 
-    // filename and shader type
-    struct ShaderNameTypePair
+    // shaders, programs and included files are referred to by their index in their respective arrays
+    using ShaderID = uint32_t;
+    using ProgramID = uint32_t;
+    using IncludeID = uint32_t;
+    using PipelineID = uint32_t;
+
+    // filename, shader type, and the #define lines of the variant and of its constants (see AddProgram)
+    struct ShaderVariantKey
     {
         std::string Name;
         GLenum Type;
-        bool operator<(const ShaderNameTypePair& rhs) const { return std::tie(Name, Type) < std::tie(rhs.Name, rhs.Type); }
+        std::string Defines;
+        std::string Constants;
+        bool operator==(const ShaderVariantKey& rhs) const { return Type == rhs.Type && Name == rhs.Name && Defines == rhs.Defines && Constants == rhs.Constants; }
+    };
+
+    struct ShaderVariantKeyHash
+    {
+        size_t operator()(const ShaderVariantKey& shader) const
+        {
+            return std::hash<std::string>()(shader.Name) ^ ((size_t)shader.Type * 31) ^ (std::hash<std::string>()(shader.Defines) * 17) ^ (std::hash<std::string>()(shader.Constants) * 13);
+        }
+    };
+
+    // hashes the (sorted) list of shaders that identifies a program
+    struct ShaderIDListHash
+    {
+        size_t operator()(const std::vector<ShaderID>& shaders) const
+        {
+            size_t h = shaders.size();
+            for (ShaderID shader : shaders)
+            {
+                h = h * 31 + shader;
+            }
+            return h;
+        }
     };
 
+    // The version, stage #define, and preamble that get prepended to every shader of a stage.
+    // Built once, and shared by the shaders using it so they can be compiled without copying it.
+    struct ShaderHeader
+    {
+        std::shared_ptr<const std::string> Text;
+        uint64_t Hash;
+    };
+
+    // A file read, compile, or link done by a worker thread (see SetWorkerThreads)
+    struct WorkerJob;
+    struct WorkerPool;
+
+    // Memory-mapped archive of shader files, used instead of the file system in frozen mode (see LoadArchive)
+    struct Archive;
+
     // Shader in the ShaderSet system
     struct Shader
     {
+        // filename and shader type
+        std::string Name;
+        GLenum Type;
+        // 0 while the shader object is released, until a program using it has to be relinked (see SetReleaseShaderObjects)
         ShaderHandle Handle;
-        // Timestamp of the last update of the shader
+        // The defines of this variant of the file (sorted), and the #define lines built from them
+        std::vector<std::string> Defines;
+        std::string DefinesSource;
+        // The constants of this variant (sorted by name), and the #define lines that pass them to GLSL compiled by the driver.
+        // SPIR-V gets them as specialization constants instead, so the constant variants of a shader share its translation.
+        ShaderConstants Constants;
+        std::string ConstantsSource;
+        // True if the file contains SPIR-V (.spv) rather than GLSL, so it's loaded with glShaderBinary. Its source is the binary itself.
+        bool Spirv;
+        // Timestamp of the last update of the shader (in nanoseconds)
+        uint64_t Timestamp;
+        // Size of the file at the last update of the shader. A change in size also counts as an update.
+        uint64_t FileSize;
+        // The number of the file in the #line directives, which maps the locations in compiler logs back to the file name (see GetFileNumber)
+        int32_t FileNumber;
+        // True while the shader is in the list of updated shaders, until its file gets read
+        bool Updated;
+        // True while the file changed, but the quiet period after the change isn't over yet (see SetQuietPeriod)
+        bool Settling;
+        // True while an asynchronous compile hasn't been checked for completion yet
+        bool Compiling;
+        // The GL_COMPILE_STATUS of the most recent compile
+        GLint CompileStatus;
+        // True if the source changed since the last compile
+        bool NeedsCompile;
+        // The source (after the #line directive that follows the header), kept from when the file is read until the shader is compiled.
+        // Shaders with constants keep it, so the variants with other values can be created without reading the file again.
+        std::string Source;
+        // The header of the source, which is passed to glShaderSource separately from the rest
+        std::shared_ptr<const std::string> SourceHeader;
+        // Hash of the assembled source, used to identify cached program binaries
+        uint64_t SourceHash;
+        // Hash of the source without the constants, used to identify the SPIR-V translation shared by the constant variants
+        uint64_t BaseSourceHash;
+        // All the files this shader (transitively) included the last time its source was read
+        std::vector<IncludeID> Includes;
+        // The programs this shader is linked into, so the programs to relink can be found without searching all programs
+        std::vector<ProgramID> Programs;
+        // The jobs reading the file and compiling the shader on worker threads, if any are in flight.
+        std::shared_ptr<WorkerJob> ReadJob;
+        std::shared_ptr<WorkerJob> CompileJob;
+        // Statistics (see ShaderStats)
+        uint32_t ReloadCount;
+        uint32_t CompileCount;
+        size_t SourceSize;
+        uint64_t ReadTime;
+        uint64_t CompileTime;
+        // When the compile in flight was issued
+        uint64_t CompileStart;
+        // True once the last program using the shader was removed, until its ID is reused by a new shader (see RemoveProgram)
+        bool Removed;
+    };
+
+    // File included by shaders with #include
+    struct IncludeFile
+    {
+        // path of the file (relative to the working directory, like shader names)
+        std::string Name;
+        // Timestamp and size of the file when its contents were last read
         uint64_t Timestamp;
-        // Hash of the name of the shader. This is used to recover the shader name from the GLSL compiler error messages.
-        // It's not a perfect solution, but it's a miracle when it doesn't work.
-        int32_t HashName;
+        uint64_t FileSize;
+        // Contents of the file, cached so it's read only once no matter how many shaders include it
+        std::string Contents;
+        // Same as Shader::FileNumber
+        int32_t FileNumber;
+        // False if the file watcher couldn't watch this file, so it gets polled at every update
+        bool Watched;
+        // True if the file watcher reported a change since the last update
+        bool NeedsPoll;
+        // Same as Shader::Settling
+        bool Settling;
+        // The shaders that (transitively) include this file. The file is removed along with the last one.
+        std::vector<ShaderID> Dependents;
+        // True once no shader includes the file anymore, until its ID is reused by a new included file
+        bool Removed;
     };
 
     // Program in the ShaderSet system.
@@ -41,42 +396,602 @@ class ShaderSet
         // the public handle becomes 0 when a linking failure happens, until the linking error gets fixed.
         ProgramHandle PublicHandle;
         ProgramHandle InternalHandle;
+        // The program object currently being linked asynchronously (0 if none). It replaces the internal handle once the link finishes.
+        ProgramHandle LinkingHandle;
+        // True while the program is waiting for its shaders to finish compiling before it can be relinked
+        bool NeedsLink;
+        // True once the compiles of the shaders needed for the pending relink have been issued
+        bool CompilesIssued;
+        // True if some of the shaders aren't attached to the internal handle because their objects were released, until they're attached again
+        bool ShadersDetached;
+        // The program binary cache key of the sources used by the most recent link
+        uint64_t BinaryCacheKey;
+        // The shaders linked into this program, sorted by ID
+        std::vector<ShaderID> Shaders;
+        // The job linking the program on a worker thread, if one is in flight.
+        std::shared_ptr<WorkerJob> LinkJob;
+        // Statistics (see ShaderProgramStats)
+        uint32_t LinkCount;
+        uint64_t LinkTime;
+        bool LoadedFromCache;
+        bool LinkSucceeded;
+        // The update count when the program was last marked as used, to relink the recently used programs first
+        uint64_t LastUsed;
+        // When the link in flight was issued
+        uint64_t LinkStart;
+        // GPU timings of the current and previous versions of the program (see ShaderProgramStats), and the version number timings are tagged with
+        uint64_t GpuTime;
+        uint32_t GpuTimeSamples;
+        uint64_t PreviousGpuTime;
+        uint32_t PreviousGpuTimeSamples;
+        uint32_t GpuTimingVersion;
+        // The resources of the program, reflected when it gets published (if reflection is enabled)
+        ShaderProgramReflection Reflection;
+        // True if the program is linked with GL_PROGRAM_SEPARABLE, as one stage of program pipelines (see SetSeparablePrograms)
+        bool Separable;
+        // The pipelines using this program as one of their stages
+        std::vector<PipelineID> Pipelines;
+        // The handles returned by AddProgramConcurrent() for this program, which are published along with the public handle
+        std::vector<GLuint*> ExtraHandles;
+        // The number of AddProgram() calls (or pipelines) that returned this program and didn't remove it yet
+        uint32_t RefCount;
+        // True once the program was removed, until its ID is reused by a new program
+        bool Removed;
+        // Incremented by every link and cached load (see ShaderProgramChange)
+        uint32_t Generation;
+    };
+
+    // Program pipeline made of separable programs, one per stage (see SetSeparablePrograms)
+    struct Pipeline
+    {
+        // The handle exposed externally, which is 0 until all the stage programs linked successfully
+        GLuint PublicHandle;
+        // The program pipeline object
+        GLuint PipelineHandle;
+        // The programs used for the stages of the pipeline, sorted by ID
+        std::vector<ProgramID> Stages;
+        // Same as Program::ExtraHandles, Program::RefCount and Program::Removed
+        std::vector<GLuint*> ExtraHandles;
+        uint32_t RefCount;
+        bool Removed;
+        // Incremented every time one of the stages changed
+        uint32_t Generation;
+        // The update count when the pipeline's change was last reported, and the index of that change in mProgramChanges
+        uint64_t ChangeUpdate;
+        size_t ChangeIndex;
+    };
+
+    // GL_TIME_ELAPSED query timing the work done with a program (see BeginGpuTiming)
+    struct GpuTimer
+    {
+        GLuint Query;
+        ProgramID Program;
+        // the Program::GpuTimingVersion when the query was issued
+        uint32_t Version;
+    };
+
+    // Program added by AddProgramConcurrent(), waiting for the next update to be added for real
+    struct PendingProgram
+    {
+        std::vector<std::pair<std::string, GLenum>> TypedShaders;
+        std::vector<std::string> Defines;
+        ShaderConstants Constants;
+        GLuint* Handle;
     };
 
+    // the names of the file numbers of the #line directives, indexed by number (null for unused numbers), and the number of each name.
+    // The name keys are stable, so the names point to them.
+    std::vector<const std::string*> mFileNumberNames;
+    std::unordered_map<std::string, int32_t> mFileNumbers;
+
+    // gets every message of the compile and link logs, if set
+    ShaderDiagnosticCallback mDiagnosticCallback;
+
+    // the programs relinked by the current (or last) call to UpdatePrograms()
+    std::vector<ShaderProgramChange> mProgramChanges;
+
     // the version in the version string that gets prepended to each shader
     std::string mVersion;
     // the preamble which gets prepended to each shader (for eg. shared binding conventions)
     std::string mPreamble;
-    // maps shader name/types to handles, in order to reuse shared shaders.
-    std::map<ShaderNameTypePair, Shader> mShaders;
+    // the file the preamble was read from, if any, so it can be reloaded and packed in archives
+    std::string mPreambleFilename;
+    // timestamp and size of the preamble file when it was last read
+    uint64_t mPreambleTimestamp = 0;
+    uint64_t mPreambleFileSize = 0;
+    // same as IncludeFile::Watched and IncludeFile::NeedsPoll, for the preamble file
+    bool mPreambleWatched = false;
+    bool mPreambleNeedsPoll = false;
+    // the headers built from the version and preamble, by shader type. Cleared when either changes.
+    std::unordered_map<GLenum, ShaderHeader> mShaderHeaders;
+    // buffer reused for reading shader files. Its storage moves into the shader read, and comes back once that shader is compiled (see RecycleShaderSource)
+    std::string mReadBuffer;
+    // all shaders, indexed by ShaderID.
+    std::vector<Shader> mShaders;
+    // maps shader name/types to shaders, in order to reuse shared shaders.
+    std::unordered_map<ShaderVariantKey, ShaderID, ShaderVariantKeyHash> mShaderIndex;
+    // maps file names to the shaders that use that file (the same file can be used with many shader types)
+    std::unordered_map<std::string, std::vector<ShaderID>> mShaderFileIndex;
+    // all programs, indexed by ProgramID. A deque rather than a vector, since AddProgram() returns pointers into it.
+    std::deque<Program> mPrograms;
     // allows looking up the program that represents a linked set of shaders
-    std::map<std::vector<const ShaderNameTypePair*>, Program> mPrograms;
+    std::unordered_map<std::vector<ShaderID>, ProgramID, ShaderIDListHash> mProgramIndex;
+    // maps the handles returned by AddProgram() back to their programs
+    std::unordered_map<const GLuint*, ProgramID> mProgramHandleIndex;
+    // protects the handles and pending programs of AddProgramConcurrent(), which can be called from any thread
+    std::mutex mRegistrationMutex;
+    // storage for the handles returned by AddProgramConcurrent(). A deque so the handles never move.
+    std::deque<GLuint> mHandleSlots;
+    std::vector<GLuint*> mFreeHandleSlots;
+    std::vector<PendingProgram> mPendingPrograms;
+
+    // the IDs of removed shaders and programs, reused by the next ones added so streaming content doesn't grow the arrays forever
+    std::vector<ShaderID> mFreeShaderIDs;
+    std::vector<ProgramID> mFreeProgramIDs;
+
+    // if true, each shader is linked into its own separable program, and AddProgram() returns program pipelines (see SetSeparablePrograms)
+    bool mSeparablePrograms = false;
+    // all program pipelines, indexed by PipelineID. A deque for the same reason as mPrograms.
+    std::deque<Pipeline> mPipelines;
+    // allows looking up the pipeline that represents a set of stage programs
+    std::unordered_map<std::vector<ProgramID>, PipelineID, ShaderIDListHash> mPipelineIndex;
+    // maps the handles returned by AddProgram() back to their pipelines
+    std::unordered_map<const GLuint*, PipelineID> mPipelineHandleIndex;
+    // same as mFreeProgramIDs
+    std::vector<PipelineID> mFreePipelineIDs;
+    std::vector<IncludeID> mFreeIncludeIDs;
+
+    // if true, #include "file" directives are resolved when the source of shaders is read (see SetIncludeSupport)
+    bool mIncludeSupport = false;
+    // files included by shaders, indexed by IncludeID.
+    // A deque rather than a vector, since the contents of included files are referenced while reading more included files.
+    std::deque<IncludeFile> mIncludeFiles;
+    // maps the path of included files to their IncludeID
+    std::unordered_map<std::string, IncludeID> mIncludeIndex;
+
+    // optional file watcher. If null, the timestamps of all shaders are polled by every UpdatePrograms()
+    std::unique_ptr<ShaderFileWatcher> mFileWatcher;
+    // shaders that need their timestamp checked on the next update (because they are new or the watcher reported a change)
+    std::vector<ShaderID> mShadersToPoll;
+    // shaders that the file watcher couldn't watch, so they get polled at every update
+    std::vector<ShaderID> mUnwatchedShaders;
+    // if true, compiles and links are issued without waiting for their results (see SetAsyncCompilation)
+    bool mAsyncCompilation = false;
+    // shaders with an asynchronous compile in flight
+    std::vector<ShaderID> mCompilingShaders;
+    // programs that need to be relinked once their shaders are done compiling
+    std::vector<ProgramID> mProgramsToLink;
+    // programs with an asynchronous link in flight
+    std::vector<ProgramID> mLinkingPrograms;
+
+    // worker threads with their own GL contexts. If null, everything is done on the thread calling UpdatePrograms()
+    std::unique_ptr<WorkerPool> mWorkers;
+    // shaders whose files are being read by worker threads
+    std::vector<ShaderID> mReadingShaders;
+    // link jobs that became out of date while in flight, and compile jobs of removed shaders. Their program objects get deleted once they finish.
+    std::vector<std::shared_ptr<WorkerJob>> mStaleJobs;
+    // removed shaders that might still be used by stale jobs. They're deleted once no stale job is left.
+    std::vector<ShaderHandle> mRemovedShaderHandles;
+
+    // receives the events of this ShaderSet, if it has one (see SetEventSink)
+    std::unique_ptr<ShaderSetEventSink> mEventSink;
+    // time taken by the most recent update
+    uint64_t mUpdateTime = 0;
+    // number of calls to UpdatePrograms() so far
+    uint64_t mUpdateCount = 0;
+    // program objects replaced by a relink, with the update that replaced them, deleted once they're mRetireDelay updates old (see SetRetireDelay)
+    std::deque<std::pair<ProgramHandle, uint64_t>> mRetiredPrograms;
+    uint32_t mRetireDelay = 2;
+    // the next file to poll, when polling every file is spread over many updates by a time budget or a fixed number of polls per update.
+    // The included files follow the shaders.
+    uint32_t mPollCursor = 0;
+    // if not 0, the number of files polled by each update when there is no file watcher (see SetPollsPerUpdate)
+    uint32_t mPollsPerUpdate = 0;
+    // the files that changed most recently (most recent last), which get polled at every update when polling a fixed number of files
+    std::vector<ShaderID> mRecentShaders;
+    std::vector<IncludeID> mRecentIncludes;
+    // the programs marked as used since the last update, and the next of their shaders to poll
+    std::vector<ProgramID> mUsedPrograms;
+    uint32_t mUsedPollCursor = 0;
+    // scratch buffer for the shaders of the used programs
+    std::vector<ShaderID> mUsedShaders;
+
+    // if true, shaders whose files were touched without changing their contents don't get recompiled (see SetContentHashing)
+    bool mContentHashing = false;
+
+    // if true, the active resources of programs are queried after every link (see SetReflection)
+    bool mReflection = false;
+
+    // if true, a failed relink leaves the previous version of the program in use (see SetKeepLastGoodProgram)
+    bool mKeepLastGoodProgram = false;
+
+    // if true, shader objects are deleted once all the programs using them are linked (see SetReleaseShaderObjects)
+    bool mReleaseShaderObjects = false;
+
+    // if true, BeginGpuTiming()/EndGpuTiming() issue timer queries (see SetGpuTiming)
+    bool mGpuTiming = false;
+    // the queries whose result wasn't read back yet, in the order they were issued, and the query started by BeginGpuTiming() (if any)
+    std::deque<GpuTimer> mPendingGpuTimers;
+    GpuTimer mActiveGpuTimer = {};
+    bool mGpuTimerActive = false;
+    // queries whose result was read back, reused by the next timings
+    std::vector<GLuint> mFreeGpuQueries;
+
+    // directory where linked program binaries are cached. Empty if the cache is disabled
+    std::string mProgramBinaryCacheDirectory;
+    // hash of the GL vendor, renderer and version strings, since program binaries are specific to a driver
+    uint64_t mDriverHash = 0;
+
+    // in-memory contents of files, read instead of the file system or the archive (see SetFileOverride)
+    std::unordered_map<std::string, std::string> mFileOverrides;
+    // receives file overrides from another machine, if set (see SetRemoteSource)
+    std::unique_ptr<ShaderRemoteSource> mRemoteSource;
+    // scratch buffer for the files received by the remote source
+    std::vector<std::pair<std::string, std::string>> mRemoteFiles;
+
+    // if set, the set is frozen: all files are read from this archive, and never polled (see LoadArchive)
+    std::unique_ptr<Archive> mArchive;
+
+    // translates GLSL to SPIR-V before handing it to the driver, if set (see SetSpirvCompiler)
+    ShaderSpirvCompiler mSpirvCompiler;
+    // directory where translated SPIR-V is cached by source hash. Empty if the cache is disabled
+    std::string mSpirvCacheDirectory;
+
+    // scratch buffer for the changes reported by the file watcher, kept to avoid reallocating it every update
+    std::vector<std::string> mChangedFiles;
+    // changes are only reloaded once no file changed for this long, in nanoseconds (see SetQuietPeriod)
+    uint64_t mQuietPeriod = 0;
+    // when the most recent change was found, and the files that changed since the last reload
+    uint64_t mLastChangeTime = 0;
+    std::vector<ShaderID> mSettlingShaders;
+    std::vector<IncludeID> mSettlingIncludes;
+
+    // shaders whose file changed, in the order they were found. Normally all read by the update that finds them,
+    // unless the time budget of the update runs out first.
+    std::vector<ShaderID> mUpdatedShaders;
+
+    // starts watching the file of a shader (or falls back to polling it), and schedules its timestamp to be checked
+    void WatchShader(ShaderID shaderID);
+    // polls the files that might have changed, and adds the changed shaders to the updated shaders.
+    // Polling every shader stops at the deadline (if any), and continues from there on the next update.
+    void PollFiles(uint64_t deadline);
+    // reloads the shaders, included file, or preamble that use a file, after its override changed
+    void ReloadFile(const std::string& filename);
+    // reads the contents of a shader file, included file, or preamble file (from its override if it has one, or from the archive in frozen mode)
+    void ReadSourceFile(const std::string& filename, std::string& contents);
+    // re-reads the preamble file if its timestamp changed, and reloads all shaders if its contents changed
+    void PollPreambleFile();
+    // reloads all the shaders whose source has a header, after the version or preamble changed
+    void MarkAllShadersUpdated();
+    // polls the recently changed files, some of the shaders of the programs in use, and some of the other files in round-robin order
+    void PollSomeFiles();
+    // checks the timestamp of a shader, and adds it to the updated shaders if it changed (or to the settling shaders, see SetQuietPeriod)
+    void PollShader(ShaderID shaderID);
+    // adds a shader to the updated shaders, unless it's already in there
+    void MarkShaderUpdated(ShaderID shaderID);
+
+    // assembles the source of a shader from the contents of its file, which marks it as needing to be compiled
+    // returns false if content hashing is enabled and the source didn't change, in which case the shader is left as-is.
+    // Also returns false if the shader object was released and the source didn't change, but then it still needs to be compiled.
+    // The contents may be swapped into the shader's source, so they're left unspecified.
+    bool ReadShaderSource(ShaderID shaderID, std::string& contents);
+    // gives a new constant variant of a shader the source kept by another variant of it, instead of reading the file.
+    // Returns false if no other variant has an up-to-date source, in which case the file has to be read.
+    bool CopyVariantSource(ShaderID shaderID);
+    // returns the header prepended to shaders of a type, building it if the version or preamble changed
+    const ShaderHeader& GetShaderHeader(GLenum type);
+    // schedules relinking the programs that use a shader whose source changed
+    void MarkProgramsToLink(ShaderID shaderID);
+    // returns the number of a file in the #line directives (the empty name is the preamble), assigning one the first time
+    int32_t GetFileNumber(const std::string& filename);
+    // maps the file numbers of a compile or link log back to file names in a single pass, and reports its messages to the diagnostic callback
+    std::string ResolveLog(const std::string& log);
+    // appends the contents of a file to a shader's source, recursively replacing its #include directives by the included files.
+    // Files in "includes" were already included, and aren't included again.
+    void AppendIncludedSource(std::string& source, const std::string& filename, const std::string& contents, int32_t fileNumber,
+                              std::vector<IncludeID>& includes);
+    // finds an included file, reading it the first time it's included
+    IncludeID FindIncludeFile(const std::string& filename);
+    // re-reads an included file if its timestamp changed, returning true if it did.
+    // Returns false if the change has to settle before the file is re-read (see SetQuietPeriod)
+    bool PollIncludeFile(IncludeID includeID);
+    // polls an included file, and marks the shaders including it as updated if it changed
+    void PollInclude(IncludeID includeID);
+    // replaces the include dependencies of a shader
+    void SetShaderIncludes(ShaderID shaderID, std::vector<IncludeID>& includes);
+
+    // compiles the previously read source of a shader
+    void CompileShader(ShaderID shaderID);
+    // reads back the compile status of a shader and reports errors.
+    // If the translation to SPIR-V failed, the shader wasn't compiled and the log of the translation is reported instead.
+    void FinishCompile(ShaderID shaderID, const std::string* translationLog = nullptr);
+    // links a program whose shaders all compiled successfully
+    void LinkProgram(ProgramID programID);
+    // reads back the link status of a program, reports errors, and updates its public handle
+    void FinishLink(ProgramID programID);
+    // frees the source of a compiled shader, giving its storage back to the read buffer if it's larger
+    void RecycleShaderSource(Shader& shader);
+    // deletes a program object that might still have been loaded by other threads, once it's old enough (see SetRetireDelay)
+    void RetireProgramObject(ProgramHandle handle);
+    // builds the statistics reported by GetStats() and the event sink
+    ShaderStats GetShaderStats(ShaderID shaderID) const;
+    ShaderProgramStats GetProgramStats(ProgramID programID) const;
+
+    // finds or creates the program linking the given shaders (sorted by ID)
+    ProgramID FindProgram(std::vector<ShaderID>& shaderIDs, bool separable);
+    // finds or creates the pipeline made of the separable programs of the given shaders
+    GLuint* AddPipeline(const std::vector<ShaderID>& shaderIDs);
+    // sets the stages of the pipelines using a program after it was relinked (or failed to), and reports the pipelines that changed
+    void UpdatePipelines(ProgramID programID, bool succeeded);
+    // sets the stages of a pipeline and publishes it, returning false (and publishing 0) if some of its stages aren't linked yet
+    bool PublishPipeline(Pipeline& pipeline);
+    // adds the handles of a program (or pipeline) that was relinked to the changes of the update, with its next generation
+    template<class ProgramOrPipeline>
+    void AddProgramChange(ProgramOrPipeline& program, bool succeeded);
+    // same as AddProgramChange, but merged with the change of the pipeline already reported by the update, if any
+    void AddPipelineChange(Pipeline& pipeline, bool succeeded);
+    // adds the programs requested by AddProgramConcurrent() since the last update
+    void AddPendingPrograms();
+    // returns a handle of AddProgramConcurrent() to the free slots
+    void FreeHandleSlot(GLuint* handle);
+    // drops a reference to a program, and deletes it (and the shaders only it used) when it was the last one
+    void ReleaseProgram(ProgramID programID);
+    // deletes a shader that is no longer used by any program, and stops polling its file
+    void RemoveShader(ShaderID shaderID);
+    // stops polling an included file that no shader includes anymore, and frees its ID
+    void RemoveIncludeFile(IncludeID includeID);
+    // deletes the objects of the shaders of a linked program that no other program is waiting for
+    void ReleaseShaderObjects(ProgramID programID);
+    // deletes a shader object once no stale job might use it anymore
+    void DeleteShaderObject(ShaderHandle handle);
+
+    // queries the active resources of a program that was just published
+    void ReflectProgram(ProgramID programID);
+    // starts a new set of GPU timings for a program that was just published, keeping the previous ones for comparison
+    void ResetGpuTiming(ProgramID programID);
+    // accumulates the results of the timer queries that are available, without waiting for the others
+    void ReadGpuTimers();
+
+    // prints the list of shaders in a program, for log messages
+    void PrintProgramShaders(const Program& program) const;
+
+    // identifies a program binary by the driver, and the type and source of each of its shaders
+    uint64_t ProgramBinaryCacheKey(const Program& program) const;
+    std::string ProgramBinaryCacheFilename(uint64_t key) const;
+    // the file caching the SPIR-V translated from a source. Empty if the cache is disabled
+    std::string SpirvCacheFilename(uint64_t sourceHash) const;
+    // tries to replace a program with its cached binary. Returns false if it's not cached or the driver rejects it.
+    bool LoadCachedProgram(ProgramID programID);
+    // saves the binary of a successfully linked program to the cache
+    void SaveCachedProgram(const Program& program);
 
 public:
-    ShaderSet() = default;
+    ShaderSet();
 
     // Destructor releases all owned shaders
     ~ShaderSet();
 
     // The version string to prepend to all shaders
     // Separated from the preamble because #version doesn't compile in C++
+    // Changing it after shaders were added reloads them on the next updates, and relinks their programs (within the time budget, if any.)
     void SetVersion(const std::string& version);
 
     // A string that gets prepended to every shader that gets compiled
     // Useful for compile-time constant #defines (like attrib locations)
+    // Changing it reloads the shaders, like SetVersion(). This stops tracking the preamble file, if any.
     void SetPreamble(const std::string& preamble);
 
     // Convenience for reading the preamble from a file
-    // The preamble is NOT auto-reloaded.
+    // The file is watched like shader files, and the shaders are reloaded if its contents change (not just its timestamp).
     void SetPreambleFile(const std::string& preambleFilename);
 
     // list of (file name, shader type) pairs
     // eg: AddProgram({ {"foo.vert", GL_VERTEX_SHADER}, {"bar.frag", GL_FRAGMENT_SHADER} });
+    // Returns nullptr if the list is empty.
     // To be const-correct, this should maybe return "const GLuint*". I'm trusting you not to write to that pointer.
-    GLuint* AddProgram(const std::vector<std::pair<std::string, GLenum>>& typedShaders);
+    //
+    // The defines select a variant of the shaders, and are added as "#define <define>" lines after the preamble.
+    // eg: AddProgram({ {"mesh.vert", GL_VERTEX_SHADER}, {"mesh.frag", GL_FRAGMENT_SHADER} }, { "SKINNING", "SHADOW_QUALITY 2" });
+    // Each (file, type, defines) variant is compiled once and shared by all the programs that use it, no matter the order of the defines.
+    // Like all shaders, variants are only compiled once a program using them gets linked, so only the requested variants are ever compiled.
+    //
+    // The constants are named integer values for variants that only differ by some numbers (eg. a kernel size.)
+    // SPIR-V shaders (and GLSL translated with SetSpirvCompiler) get them as specialization constants, by the names of their OpName.
+    // Other GLSL gets them as "#define <name> <value>" lines after the defines, so a shader can be written for both:
+    //     #ifndef KERNEL_SIZE
+    //     layout(constant_id = 0) const int KERNEL_SIZE = 3;
+    //     #endif
+    // A shader added with constants keeps its source, so adding the program again with other values (a new program, which replaces
+    // the old one with RemoveProgram) only compiles or specializes the new variant, without reading the files again.
+    GLuint* AddProgram(const std::vector<std::pair<std::string, GLenum>>& typedShaders, const std::vector<std::string>& defines = {}, const ShaderConstants& constants = {});
+
+    // Same as AddProgram(), but can be called from any thread, even while another thread is calling UpdatePrograms().
+    // It only takes a short lock to queue the program, which is added by the next UpdatePrograms() (so errors in file names are reported then.)
+    // Unlike AddProgram(), each call returns a new handle (0 until the program links), which has to be removed with RemoveProgram()
+    // from the thread calling UpdatePrograms(). Read it with LoadHandle() from other threads.
+    GLuint* AddProgramConcurrent(const std::vector<std::pair<std::string, GLenum>>& typedShaders, const std::vector<std::string>& defines = {}, const ShaderConstants& constants = {});
+
+    // Reads a handle returned by AddProgram*() from a thread other than the one calling UpdatePrograms(), eg. to record draws.
+    // UpdatePrograms() publishes new handles with release semantics, and this loads them with acquire semantics.
+    // The handles are plain GLuints so they can be passed to GL directly, and are accessed atomically the way std::atomic_ref (C++20) does,
+    // with the atomic builtins of the compiler. The program object behind a value stays valid for a few updates after a relink replaced it (see SetRetireDelay)
+    static GLuint LoadHandle(const GLuint* program)
+    {
+#ifdef _MSC_VER
+        static_assert(sizeof(long) == sizeof(GLuint), "handles are accessed as longs");
+        return (GLuint)_InterlockedCompareExchange((volatile long*)program, 0, 0);
+#else
+        return __atomic_load_n(program, __ATOMIC_ACQUIRE);
+#endif
+    }
+
+    // Removes a program returned by AddProgram*() (or a program pipeline, see SetSeparablePrograms.)
+    // Programs are reference counted: adding the same program N times returns the same handle, which must be removed N times.
+    // When the last reference is removed, the program is deleted, and so are the shaders that no other program uses,
+    // which stop being polled. The handle must not be used afterwards, since it gets reused by programs added later.
+    void RemoveProgram(const GLuint* program);
 
     // Polls the timestamps of all the shaders and recompiles/relinks them if they changed
-    void UpdatePrograms();
+    // If a file watcher is set, only the timestamps of files reported as changed by the watcher are polled.
+    // Returns the programs relinked by this call (valid until the next call), in the order they were relinked, to update only the
+    // state derived from those (a program relinked more than once by the same call is in it more than once, with increasing generations.)
+    // A pipeline is in it at most once per call, once all of its stages are linked, even if several of its stages were relinked.
+    // eg: for (const ShaderProgramChange& change : shaders.UpdatePrograms()) { myMaterialCache.Invalidate(change.Program); }
+    const std::vector<ShaderProgramChange>& UpdatePrograms();
+
+    // Same as UpdatePrograms(), but stops polling timestamps, reading files, compiling and linking once the time budget (in nanoseconds) is spent.
+    // The remaining work carries over to the next calls, where the most recently used programs (see MarkProgramUsed) are relinked first.
+    // Each call makes some progress even if a single compile or link takes longer than the budget.
+    // Only polling every file (shaders, then included files) is spread over many calls, since the files reported by a file watcher are few.
+    const std::vector<ShaderProgramChange>& UpdatePrograms(uint64_t timeBudget);
+
+    // Hints that a program was just used, so its pending relink is done before the relinks of programs that weren't used recently.
+    // When polling a fixed number of files per update (see SetPollsPerUpdate), it also makes the program's files get polled sooner.
+    void MarkProgramUsed(const GLuint* program);
+
+    // Without a file watcher, limits the number of files (shaders and included files) whose timestamp is checked by each update,
+    // so the cost of polling stays the same no matter how many files there are. Pass 0 (the default) to poll every file at every update.
+    // The few most recently changed files are polled at every update (on top of the limit), since they tend to be edited again.
+    // Up to half of the polls go to the shaders of the programs marked as used (see MarkProgramUsed), and the rest go through all files
+    // in round-robin order, so a change to a file is noticed within (number of files) / (polls per update / 2) updates.
+    void SetPollsPerUpdate(uint32_t pollsPerUpdate);
+
+    // Returns how much work is left for the next updates, eg. to show a "recompiling N shaders" indicator
+    ShaderSetProgress GetProgress() const;
+
+    // Returns true once a program (or pipeline) returned by AddProgram*() has no link pending or in flight, whether it succeeded or not.
+    // eg: at startup, only draw the objects whose programs are ready, while the others are still compiling in the background.
+    bool IsProgramReady(const GLuint* program) const;
+
+    // Updates until all the programs added so far are ready, eg. on a loading screen. The callback (if any) gets the progress after each update.
+    // All the compiles are issued by the first update, before any link, so they run in parallel on the worker threads (see SetWorkerThreads)
+    // or in the driver (see SetAsyncCompilation), and the file reads are done by the workers too. Without either, everything is done serially.
+    // Returns the changes of all the updates it did, like UpdatePrograms() does.
+    std::vector<ShaderProgramChange> Prewarm(const std::function<void(const ShaderSetProgress& progress)>& progressCallback = nullptr);
+
+    // Sets the backend used to detect file changes. Pass nullptr to go back to polling every file at every update.
+    // eg: SetFileWatcher(CreateNativeShaderFileWatcher());
+    // If the watcher is null (eg. if the platform has no native watcher), polling is used.
+    void SetFileWatcher(std::unique_ptr<ShaderFileWatcher> fileWatcher);
+
+    // Sets the object that receives timing events and profiler scopes. Pass nullptr to stop reporting events.
+    void SetEventSink(std::unique_ptr<ShaderSetEventSink> eventSink);
+
+    // Returns a snapshot of the statistics of all shaders and programs (timings, source sizes, reload counts)
+    ShaderSetStats GetStats() const;
+
+    // Moves file reads, compiles and links to worker threads, so the thread calling UpdatePrograms() never waits on the GLSL compiler.
+    // Each worker gets its own GL context from the callbacks, which must share objects with the context current when calling this.
+    // Finished programs are published by UpdatePrograms() once a fence from the worker signals that the link is visible to this context.
+    // Resolving includes and hashing sources still happens in UpdatePrograms(), since it updates the dependencies between files.
+    // All three callbacks must be set, otherwise no worker is started and the work stays on the thread calling UpdatePrograms().
+    // Pass 0 threads to stop the workers (after they finish the work already given to them), in which case the callbacks are unused.
+    void SetWorkerThreads(int numThreads, const ShaderWorkerContextCallbacks& callbacks);
+
+    // Enables linking each shader into its own separable program (GL_ARB_separate_shader_objects, core in GL 4.1).
+    // AddProgram() then returns the handle of a program pipeline object made of those programs, to bind with glBindProgramPipeline() (without glUseProgram()).
+    // The handle is 0 until all stages have linked successfully.
+    // A change to a shader only relinks its own program, instead of every program combining it with other shaders.
+    // Must be set before adding programs.
+    void SetSeparablePrograms(bool separablePrograms);
+
+    // Enables issuing all compiles and links without waiting for them, for drivers that compile in the background.
+    // Requires GL_KHR_parallel_shader_compile (or GL_ARB_parallel_shader_compile), since completion is checked with GL_COMPLETION_STATUS_KHR.
+    // UpdatePrograms() then picks up finished compiles and links on later calls, and only swaps the public handle
+    // of a program once its new version is done linking. Until then, the previously linked program stays in use.
+    void SetAsyncCompilation(bool asyncCompilation);
+
+    // Waits until no file changed for the quiet period (in nanoseconds) before reloading any changed file. 0 (the default) disables waiting.
+    // This avoids compiling half-written files and relinking many times while an editor saves a file or a script regenerates many files.
+    // All the files that change within the same burst are reloaded by the same update, so each affected program is relinked once.
+    // Files are still loaded right away the first time.
+    void SetQuietPeriod(uint64_t quietPeriod);
+
+    // Enables comparing a hash of the source of shaders whose file timestamp or size changed, and only recompiling them if it differs.
+    // This avoids recompiling and relinking after a file is touched without changing (eg. by a VCS checkout or a build step.)
+    void SetContentHashing(bool contentHashing);
+
+    // Enables keeping the previous successfully linked version of a program as its public handle when relinking it fails,
+    // instead of setting the handle to 0. Once a program linked successfully, its handle is then never 0 again, so draws never need to check it.
+    // Relinks are done into fresh program objects, so the previous one stays usable. It's retired once the new version links successfully (see SetRetireDelay)
+    void SetKeepLastGoodProgram(bool keepLastGoodProgram);
+
+    // Sets the number of updates the program objects replaced by a relink are kept for before being deleted (2 by default),
+    // since other threads might still be recording draws with a handle they loaded earlier (see LoadHandle).
+    // eg: SetRetireDelay(framesOfLatency) when each frame calls UpdatePrograms() and its draws are recorded over several frames.
+    void SetRetireDelay(uint32_t numUpdates);
+
+    // Enables deleting shader objects once all the programs using them have linked, to save the driver memory taken by compiled shaders.
+    // Only the hash and timestamp of their source are kept. When a program needs to be relinked (because one of its other shaders changed),
+    // the released shaders are read and compiled again, so live reloading works as usual but relinks cost more compiles.
+    void SetReleaseShaderObjects(bool releaseShaderObjects);
+
+    // Enables timing the GPU work done with programs, with GL_TIME_ELAPSED queries (GL 3.3 or GL_ARB_timer_query).
+    // Bracket the draws or dispatches that use a program with BeginGpuTiming() and EndGpuTiming(), and the times show up in the
+    // program's stats (see GetStats) once UpdatePrograms() reads back the results, which it does without waiting for the GPU.
+    // The times restart from 0 each time the program is relinked, and the times of the version before the relink are kept for comparison.
+    void SetGpuTiming(bool gpuTiming);
+
+    // Starts timing GPU work done with a program returned by AddProgram*() (not a program pipeline), until EndGpuTiming().
+    // Timings can't be nested or overlap, since only one GL_TIME_ELAPSED query can be active at a time. Does nothing if timing is disabled.
+    void BeginGpuTiming(const GLuint* program);
+    void EndGpuTiming();
+
+    // Enables querying the active uniforms, attributes, uniform blocks and shader storage blocks of programs after each successful link.
+    // Shader storage blocks require GL 4.3 (or GL_ARB_program_interface_query and GL_ARB_shader_storage_buffer_object).
+    void SetReflection(bool reflection);
+
+    // Returns the reflected resources of a program (as returned by AddProgram), or nullptr if reflection is disabled or it's not one of its programs.
+    // Compare the generation to the one of the previous call to know when the locations need to be looked up again.
+    // eg: if (reflection->Generation != myGeneration) { myLocation = reflection->GetUniformLocation("uColor"); myGeneration = reflection->Generation; }
+    // Programs pipelines have no reflection, since each of their stages has its own locations.
+    const ShaderProgramReflection* GetReflection(const GLuint* program) const;
+
+    // Enables resolving #include "file" directives in shaders (and in the files they include.)
+    // Paths are relative to the directory of the file containing the #include. Each file is included at most once per shader
+    // (as if it had #pragma once), and #line directives are inserted so errors point to the right file and line.
+    // Included files are watched for changes too, and editing one only recompiles the shaders that (transitively) include it.
+    void SetIncludeSupport(bool includeSupport);
+
+    // Enables caching linked programs in the given directory (which must already exist), using glGetProgramBinary/glProgramBinary.
+    // Programs whose sources (version, stage defines, preamble and file contents) match a cached binary skip compiling and linking,
+    // which speeds up startup. Binaries are also keyed by the GL vendor, renderer and version strings, so
+    // this must be called with the GL context current. If the driver rejects a binary, the program is compiled from source as usual
+    // and its cache entry is rewritten. Pass an empty string to disable the cache.
+    void SetProgramBinaryCacheDirectory(const std::string& directory);
+
+    // Makes the GLSL source of shaders go through a translator to SPIR-V (eg. glslang), which is then loaded with glShaderBinary and glSpecializeShader.
+    // Requires GL 4.6 (or GL_ARB_gl_spirv). With worker threads, the translator is called from the workers, so it must be thread-safe.
+    // The translated SPIR-V is cached in the directory (if not empty) by the hash of the source, so unchanged shaders don't need to be translated again.
+    // Include something identifying the version of the translator in the directory name, since the cache doesn't know about it.
+    // Shaders added from .spv files are always loaded as SPIR-V, with or without a translator. Pass nullptr to go back to compiling GLSL.
+    void SetSpirvCompiler(ShaderSpirvCompiler compiler, const std::string& cacheDirectory = "");
+
+    // Makes a file be read from memory instead of the file system (or the archive in frozen mode), eg. with contents received from another machine.
+    // The shaders, included files, and preamble using it are reloaded on the next update, as if the file changed. The override stays until cleared.
+    void SetFileOverride(const std::string& filename, const std::string& contents);
+
+    // Goes back to reading a file from the file system (or the archive), which reloads it too.
+    void ClearFileOverride(const std::string& filename);
+
+    // Sets the backend that receives files from another machine, which UpdatePrograms() applies as file overrides. Pass nullptr to stop receiving.
+    // eg: SetRemoteSource(CreateSocketShaderRemoteSource(7878));
+    void SetRemoteSource(std::unique_ptr<ShaderRemoteSource> remoteSource);
+
+    // Sets a function that gets each message of the compile and link logs (eg. to list them in an editor), as they're printed.
+    void SetDiagnosticCallback(ShaderDiagnosticCallback callback);
+
+    // Packs the files of all the shaders added so far (with the files they include, and the preamble file) into a single archive file,
+    // to be loaded with LoadArchive() by release builds. Returns false if the archive couldn't be written.
+    // If includeProgramBinaries is true, the binaries of the successfully linked programs are packed too, and loaded from the archive
+    // instead of compiling the shaders (if the driver accepts them). They're only available if the program binary cache is enabled.
+    bool WriteArchive(const std::string& filename, bool includeProgramBinaries = false);
+
+    // Freezes the set: all files are read from the archive (memory-mapped) instead of the file system, and are never polled for changes.
+    // The AddProgram*() functions work as usual, and UpdatePrograms() only compiles and links the programs added since the last update.
+    // Must be called before adding programs, and with the GL context current if the archive contains program binaries.
+    // Returns false if the archive couldn't be loaded (or programs were added already), in which case the set keeps using the file system.
+    bool LoadArchive(const std::string& filename);
 
     // Convenience to add shaders based on extension file naming conventions
     // vertex shader: .vert
@@ -85,9 +1000,11 @@ public:
     // tessellation control shader: .tesc
     // tessellation evaluation shader: .tese
     // compute shader: .comp
+    // SPIR-V binaries of any of those are added by appending .spv, eg. foo.vert.spv (they must have a "main" entry point.)
     // eg: AddProgramFromExts({"foo.vert", "bar.frag"});
     // To be const-correct, this should maybe return "const GLuint*". I'm trusting you not to write to that pointer.
-    GLuint* AddProgramFromExts(const std::vector<std::string>& shaders);
+    // The defines and constants select a variant, like with AddProgram().
+    GLuint* AddProgramFromExts(const std::vector<std::string>& shaders, const std::vector<std::string>& defines = {}, const ShaderConstants& constants = {});
 
     // Convenience to add a single file that contains many shader stages.
     // Similar to what is explained here: https://software.intel.com/en-us/blogs/2012/03/26/using-ifdef-in-opengl-es-20-shaders
@@ -113,5 +1030,7 @@ public:
     //     #ifdef FRAGMENT_SHADER
     //     void main() { /* your fragment shader main */ }
     //     #endif
-    GLuint* AddProgramFromCombinedFile(const std::string &filename, const std::vector<GLenum> &shaderTypes);
+    //
+    // The defines and constants select a variant, like with AddProgram().
+    GLuint* AddProgramFromCombinedFile(const std::string &filename, const std::vector<GLenum> &shaderTypes, const std::vector<std::string>& defines = {}, const ShaderConstants& constants = {});
 };